@@ -13,9 +13,15 @@ import click
 # @todo(later) How could I refer to these as `instrumentation.shell` and `instrumentation.cpp`?
 from .instrumentation import shell as shell_instrumentation
 from .instrumentation import cpp as cpp_instrumentation
+from .monitoring import result as monitoring_result
 from .monitoring.runner import Runner
-from .reporting.graph import make_graph
-from .reporting.summaries import make_summaries
+from .reporting import compare as compare_reporting
+from .reporting.call_paths import CallPathsExtractor, write_call_paths, write_folded_stacks
+from .reporting.graph import GantGrapher, WindowedSummariesExtractor, make_graph
+from .reporting.locks import LockContentionsExtractor, write_lock_contentions
+from .reporting.overhead import InstrumentationOverheadExtractor, write_instrumentation_overhead
+from .reporting.summaries import MultiThreadedDurationsExtractor, make_summaries, make_thread_imbalances, make_throughput_summaries, summarize, write_thread_imbalances, write_throughputs
+from .reporting.timeline import iter_timeline
 
 
 @click.group(help="Chrones is a software development tool to visualize runtime statistics about your program and correlate them with the phases of your program. Please visit https://github.com/jacquev6/Chrones for more details.")
@@ -44,9 +50,10 @@ def shell():
 
 
 @shell.command(help="Display the 'chrones_*' shell fonctions. Use as 'source <(chrones instrument shell enable PROGRAM_NAME)'.")
+@click.option("--light", is_flag=True, help="Aggregate stopwatches in memory and log only their summaries, when the script exits. Like 'MINICHRONE' in C++.")
 @click.argument("program-name")
-def enable(*, program_name):
-    for line in shell_instrumentation.enable(program_name):
+def enable(*, light, program_name):
+    for line in shell_instrumentation.enable(program_name, light=light):
         print(line)
 
 
@@ -59,22 +66,34 @@ def enable(*, program_name):
 """))
 @click.option("--logs-dir", default=".", help="Directory where instrumentation and monitoring logs will be stored.")
 @click.option("--monitor-gpu", is_flag=True, help="Measure GPU usage.")
+@click.option("--monitor-threads", is_flag=True, help="Measure CPU usage, state and context switches of each thread.")
 @click.option("--monitoring-interval", type=float, default=0.2, help="Interval between two consecutives measures, in seconds.")
 @click.option("--allowed-missing-samples", type=int, default=1, help="Number of successive samples that can be skipped before Chrones start displaying warnings about \"slow monitoring\".")
+@click.option("--monitoring-backend", type=click.Choice(["psutil", "proc"]), default="psutil", help="How to measure processes. 'proc' reads '/proc' directly and can keep up with shorter monitoring intervals.")
+@click.option("--live-hotspots", type=int, default=0, help="While the program runs, periodically print the N stopwatches with the largest total and self times. 0 to disable.", metavar="N")
+@click.option("--live-hotspots-interval", type=float, default=10, help="Interval between two consecutive prints of the live hotspots, in seconds.")
 @click.argument("command", nargs=-1, type=click.UNPROCESSED)
 def run(
     *,
     logs_dir,
     monitor_gpu,
+    monitor_threads,
     monitoring_interval,
     allowed_missing_samples,
+    monitoring_backend,
+    live_hotspots,
+    live_hotspots_interval,
     command,
 ):
     runner = Runner(
         monitor_gpu=monitor_gpu,
+        monitor_threads=monitor_threads,
         logs_directory=logs_dir,
         monitoring_interval=monitoring_interval,
         allowed_missing_samples=allowed_missing_samples,
+        monitoring_backend=monitoring_backend,
+        live_hotspots=live_hotspots,
+        live_hotspots_interval=live_hotspots_interval,
     )
     result = runner.run(list(command))
     result.save(logs_dir)
@@ -85,11 +104,89 @@ def run(
 @main.command(help="Create a human-readable image from monitoring logs.")
 @click.option("--logs-dir", default=".", help="Directory containing instrumentation and monitoring logs.")
 @click.option("--output-name", default="report.png", help="Output name for the report.")
+@click.option("--call-paths", default=None, help="Also write inclusive time, exclusive time and executions count of each call path to this file.", metavar="FILE")
+@click.option("--folded-stacks", default=None, help="Also write exclusive times in nanoseconds of each call path to this file, in the folded stacks format of flame graph tools.", metavar="FILE")
+@click.option("--from", "time_from", type=float, default=None, help="Start of the time window to draw, in seconds since the start of the program. Chrones shorter than a pixel are merged, so narrow windows show more details.", metavar="SECONDS")
+@click.option("--to", "time_to", type=float, default=None, help="End of the time window to draw, in seconds since the start of the program.", metavar="SECONDS")
 @click.option("--with-summaries", default=None, hidden=True)
-def report(*, logs_dir, output_name, with_summaries):
+def report(*, logs_dir, output_name, call_paths, folded_stacks, time_from, time_to, with_summaries):
     output_name = os.path.abspath(output_name)
+    if call_paths is not None:
+        call_paths = os.path.abspath(call_paths)
+    if folded_stacks is not None:
+        folded_stacks = os.path.abspath(folded_stacks)
     os.chdir(logs_dir)
-    make_graph(output_name)
+    results = monitoring_result.RunResults.load()
+
+    # Logs are read only once: each event is passed to all the extractors of the report
+    gantt_grapher = GantGrapher(results)
+    windowed_summaries = WindowedSummariesExtractor()
+    overhead = InstrumentationOverheadExtractor(results)
+    locks = LockContentionsExtractor()
+    durations = MultiThreadedDurationsExtractor()
+    extractors = [gantt_grapher, windowed_summaries, overhead, locks, durations]
+    if call_paths is not None or folded_stacks is not None:
+        call_paths_extractor = CallPathsExtractor()
+        extractors.append(call_paths_extractor)
+    for event in iter_timeline(results.main_process):
+        for extractor in extractors:
+            extractor.process(event)
+
+    make_graph(output_name, results, gantt_grapher, windowed_summaries.result, time_from=time_from, time_to=time_to)
+    overheads = overhead.result
+    if overheads:
+        write_instrumentation_overhead(overheads, sys.stdout)
+    contentions = locks.result
+    if contentions:
+        write_lock_contentions(contentions, sys.stdout)
+    imbalances = make_thread_imbalances(durations)
+    if imbalances:
+        write_thread_imbalances(imbalances, sys.stdout)
+    summaries = list(summarize(durations))
+    throughputs = make_throughput_summaries(summaries)
+    if throughputs:
+        write_throughputs(throughputs, sys.stdout)
+    if call_paths is not None or folded_stacks is not None:
+        paths = call_paths_extractor.result
+        if call_paths is not None:
+            write_call_paths(paths, call_paths)
+        if folded_stacks is not None:
+            write_folded_stacks(paths, folded_stacks)
     if with_summaries is not None:
         with open(with_summaries, "w") as f:
-            json.dump(make_summaries(), f)
+            json.dump(make_summaries(summaries), f)
+
+
+@main.command(help=textwrap.dedent("""\
+    Compare the stopwatches of two runs, matched by function and label.
+    Display the relative changes from LOGS_DIR_A to LOGS_DIR_B, and the p-value of a Mann-Whitney U test on their durations.
+
+    Exit with a non-zero code if any of the given maximum increases is exceeded.
+"""))
+@click.option("--max-total-increase", type=float, default=None, help="Maximum increase of the total duration of a stopwatch, in percent.", metavar="PERCENT")
+@click.option("--max-mean-increase", type=float, default=None, help="Maximum increase of the mean duration of a stopwatch, in percent.", metavar="PERCENT")
+@click.option("--max-median-increase", type=float, default=None, help="Maximum increase of the median duration of a stopwatch, in percent.", metavar="PERCENT")
+@click.option("--max-p99-increase", type=float, default=None, help="Maximum increase of the 99th percentile of the durations of a stopwatch, in percent.", metavar="PERCENT")
+@click.option("--significance", type=float, default=0.05, help="Increases of the mean, median and P99 are regressions only if their p-value is below this level. Totals, and stopwatches whose durations are not known (light stopwatches), are not tested.")
+@click.argument("logs-dir-a")
+@click.argument("logs-dir-b")
+def compare(*, max_total_increase, max_mean_increase, max_median_increase, max_p99_increase, significance, logs_dir_a, logs_dir_b):
+    def ratio(percent):
+        return None if percent is None else percent / 100
+
+    a = compare_reporting.load_run_stopwatches(logs_dir_a)
+    b = compare_reporting.load_run_stopwatches(logs_dir_b)
+    comparisons = compare_reporting.compare_runs(
+        a, b,
+        compare_reporting.Thresholds(
+            total=ratio(max_total_increase),
+            mean=ratio(max_mean_increase),
+            median=ratio(max_median_increase),
+            percentile_99=ratio(max_p99_increase),
+            significance=significance,
+        ),
+    )
+    compare_reporting.write_comparisons(comparisons, sys.stdout)
+    compare_reporting.write_unmatched(a, b, sys.stdout)
+    if any(comparison.regressions for comparison in comparisons):
+        sys.exit(1)
@@ -0,0 +1,229 @@
+// Copyright 2020-2022 Laurent Cabaret
+// Copyright 2020-2022 Vincent Jacques
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "chrones.hpp"
+
+
+// Count allocations, to report them per stopwatch.
+// GCC sees 'std::free' called on pointers returned by 'operator new', but they come from 'std::malloc'.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(std::size_t size) {
+  ++allocations;
+  void* p = std::malloc(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+
+// Discard the log, but count its size
+class CountingBuffer : public std::streambuf {
+ public:
+  CountingBuffer() : std::streambuf(), size(0) {}
+
+  std::size_t size;
+
+ protected:
+  int_type overflow(int_type c) override {
+    ++size;
+    return c;
+  }
+
+  std::streamsize xsputn(const char*, std::streamsize n) override {
+    size += n;
+    return n;
+  }
+};
+
+struct Log {
+  Log() : buffer(), stream(&buffer) {}
+
+  CountingBuffer buffer;
+  std::ostream stream;
+};
+
+
+// All variants of stopwatches
+struct HeavyPlain {
+  static void run(chrones::coordinator* c) {
+    chrones::heavy_stopwatch_tmpl<chrones::RealInfo>(c, "f");
+  }
+};
+
+struct HeavyLabelled {
+  static void run(chrones::coordinator* c) {
+    chrones::heavy_stopwatch_tmpl<chrones::RealInfo>(c, "f", "label");
+  }
+};
+
+struct HeavyFull {
+  static void run(chrones::coordinator* c) {
+    chrones::heavy_stopwatch_tmpl<chrones::RealInfo>(c, "f", "label", 42);
+  }
+};
+
+struct LightPlain {
+  static void run(chrones::coordinator* c) {
+    chrones::plain_light_stopwatch_tmpl<chrones::RealInfo>(c, "f");
+  }
+};
+
+struct LightLabelled {
+  static void run(chrones::coordinator* c) {
+    chrones::labelled_light_stopwatch_tmpl<chrones::RealInfo>(c, "f", "label");
+  }
+};
+
+struct LightIndexed {
+  static void run(chrones::coordinator* c) {
+    chrones::indexed_light_stopwatch_tmpl<chrones::RealInfo>(c, "f", "label", 42);
+  }
+};
+
+
+// Cost of a start/stop pair on a single thread, and what it produces
+template<typename Stopwatch>
+void BM_Stopwatch(benchmark::State& state) {  // NOLINT(runtime/references)
+  Log log;
+  chrones::coordinator* c = new chrones::coordinator(log.stream);
+  const uint64_t allocations_before = allocations;
+
+  for (auto _ : state) {
+    Stopwatch::run(c);
+  }
+
+  const uint64_t stopwatches_allocations = allocations - allocations_before;
+  delete c;  // Flush the log. Not timed: the timer stops when the loop ends
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["allocations_per_stopwatch"] =
+    benchmark::Counter(stopwatches_allocations, benchmark::Counter::kAvgIterations);
+  state.counters["log_bytes_per_stopwatch"] = benchmark::Counter(log.buffer.size, benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK_TEMPLATE(BM_Stopwatch, HeavyPlain);
+BENCHMARK_TEMPLATE(BM_Stopwatch, HeavyLabelled);
+BENCHMARK_TEMPLATE(BM_Stopwatch, HeavyFull);
+BENCHMARK_TEMPLATE(BM_Stopwatch, LightPlain);
+BENCHMARK_TEMPLATE(BM_Stopwatch, LightLabelled);
+BENCHMARK_TEMPLATE(BM_Stopwatch, LightIndexed);
+
+
+// Scaling with the number of threads sharing a coordinator
+static Log* shared_log = nullptr;
+static chrones::coordinator* shared_coordinator = nullptr;
+
+void set_up_shared_coordinator(const benchmark::State&) {
+  shared_log = new Log;
+  shared_coordinator = new chrones::coordinator(shared_log->stream);
+}
+
+void tear_down_shared_coordinator(const benchmark::State&) {
+  delete shared_coordinator;
+  delete shared_log;
+}
+
+template<typename Stopwatch>
+void BM_StopwatchThreads(benchmark::State& state) {  // NOLINT(runtime/references)
+  for (auto _ : state) {
+    Stopwatch::run(shared_coordinator);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+#define BENCHMARK_THREADS(Stopwatch) \
+  BENCHMARK_TEMPLATE(BM_StopwatchThreads, Stopwatch) \
+    ->Setup(set_up_shared_coordinator) \
+    ->Teardown(tear_down_shared_coordinator) \
+    ->ThreadRange(1, std::max(1u, std::thread::hardware_concurrency())) \
+    ->UseRealTime()
+
+BENCHMARK_THREADS(HeavyPlain);
+BENCHMARK_THREADS(HeavyLabelled);
+BENCHMARK_THREADS(HeavyFull);
+BENCHMARK_THREADS(LightPlain);
+BENCHMARK_THREADS(LightLabelled);
+BENCHMARK_THREADS(LightIndexed);
+
+
+// Throughput of the formatting done by 'flush_events', in the CSV and block formats
+std::vector<std::unique_ptr<chrones::Event>> make_events() {
+  std::vector<std::unique_ptr<chrones::Event>> events;
+  const int64_t time = chrones::RealInfo::get_time();
+  for (int i = 0; i != 50000; ++i) {
+    events.push_back(chrones::make_unique<chrones::StopwatchStartFullEvent>(
+      chrones::RealInfo::get_thread_id(), time + 100 * i, "int f()", "label", i % 10));
+    events.push_back(chrones::make_unique<chrones::StopwatchStopEvent>(
+      chrones::RealInfo::get_thread_id(), time + 100 * i + 50));
+  }
+  return events;
+}
+
+void BM_FlushCsv(benchmark::State& state) {  // NOLINT(runtime/references)
+  const auto events = make_events();
+  std::size_t log_size = 0;
+
+  for (auto _ : state) {
+    Log log;
+    chrones::CsvFormatter formatter;
+    for (const auto& event : events) {
+      formatter << 42 << ',' << *event << '\n';
+      if (formatter.size() >= (1 << 20)) {
+        formatter.write_to(log.stream);
+      }
+    }
+    formatter.write_to(log.stream);
+    log_size += log.buffer.size;
+  }
+
+  state.SetItemsProcessed(state.iterations() * events.size());
+  state.SetBytesProcessed(log_size);
+}
+
+BENCHMARK(BM_FlushCsv)->Unit(benchmark::kMillisecond);
+
+void BM_FlushBlocks(benchmark::State& state) {  // NOLINT(runtime/references)
+  const auto events = make_events();
+  std::size_t log_size = 0;
+
+  for (auto _ : state) {
+    Log log;
+    chrones::BlockLogWriter writer(log.stream, 65536);
+    for (const auto& event : events) {
+      writer.write(42, *event);
+    }
+    writer.flush();
+    log_size += log.buffer.size;
+  }
+
+  state.SetItemsProcessed(state.iterations() * events.size());
+  state.SetBytesProcessed(log_size);
+}
+
+BENCHMARK(BM_FlushBlocks)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,129 @@
+// Copyright 2020-2022 Laurent Cabaret
+// Copyright 2020-2022 Vincent Jacques
+
+// Automatic instrumentation of all functions of a program compiled with GCC's '-finstrument-functions'.
+// Compile and link this file (without '-finstrument-functions') with your program, which must use 'CHRONABLE'.
+// Functions are identified by their address; 'chrones report' resolves them to names.
+// See the C++ section of the README for details.
+
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "chrones.hpp"
+
+
+namespace {
+
+// The start times of the functions being executed by the current thread, -1 for those not timed.
+// A plain array (and not a std::vector) to avoid calling anything that could itself be instrumented.
+const std::size_t max_call_depth = 1024;
+thread_local int64_t start_times[max_call_depth];
+thread_local std::size_t call_depth = 0;
+// Set while in a hook, so that functions called by Chrones itself are not timed
+thread_local bool in_hook = false;
+
+struct FunctionsSettings {
+  FunctionsSettings() : light(false), max_depth(0), excluded() {}
+
+  static FunctionsSettings from_environment() {
+    FunctionsSettings settings;
+
+    const char* stopwatches = std::getenv("CHRONES_FUNCTIONS_STOPWATCHES");
+    settings.light = stopwatches && std::string(stopwatches) == "light";
+
+    settings.max_depth = chrones::get_size_from_environment("CHRONES_FUNCTIONS_MAX_DEPTH", 0);
+
+    const char* excluded = std::getenv("CHRONES_FUNCTIONS_EXCLUDED");
+    if (excluded) {
+      std::istringstream iss(excluded);
+      std::string symbol;
+      while (std::getline(iss, symbol, ',')) {
+        // Requires the program to be linked with '-rdynamic' for functions of the executable itself
+        const void* address = ::dlsym(RTLD_DEFAULT, symbol.c_str());
+        if (address) {
+          settings.excluded.push_back(address);
+        }
+      }
+      std::sort(settings.excluded.begin(), settings.excluded.end());
+    }
+
+    return settings;
+  }
+
+  bool is_excluded(const void* address) const {
+    return std::binary_search(excluded.begin(), excluded.end(), address);
+  }
+
+  bool light;
+  std::size_t max_depth;
+  std::vector<const void*> excluded;
+};
+
+const FunctionsSettings& functions_settings() {
+  static const FunctionsSettings settings = FunctionsSettings::from_environment();
+  return settings;
+}
+
+}  // namespace
+
+
+extern "C" {
+
+void __cyg_profile_func_enter(void* function, void*) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void* function, void*) __attribute__((no_instrument_function));
+
+void __cyg_profile_func_enter(void* function, void*) {
+  const std::size_t depth = call_depth++;
+  if (depth >= max_call_depth) {
+    return;
+  }
+  start_times[depth] = -1;
+
+  chrones::coordinator* coordinator = chrones::global_coordinator.get();
+  if (in_hook || !coordinator) {
+    return;
+  }
+  in_hook = true;
+  const FunctionsSettings& settings = functions_settings();
+  if ((settings.max_depth == 0 || depth < settings.max_depth) && !settings.is_excluded(function)) {
+    chrones::save_memory_maps();
+    if (settings.light) {
+      start_times[depth] = coordinator->start_light_stopwatch();
+    } else {
+      coordinator->start_function_heavy_stopwatch(function);
+      start_times[depth] = 0;
+    }
+  }
+  in_hook = false;
+}
+
+void __cyg_profile_func_exit(void* function, void*) {
+  const std::size_t depth = --call_depth;
+  if (depth >= max_call_depth) {
+    return;
+  }
+  // Read before calling anything: functions called from here would reuse this slot
+  const int64_t start_time = start_times[depth];
+  if (start_time == -1) {
+    return;
+  }
+
+  chrones::coordinator* coordinator = chrones::global_coordinator.get();
+  if (!coordinator) {
+    return;
+  }
+  in_hook = true;
+  if (functions_settings().light) {
+    coordinator->stop_function_light_stopwatch(function, start_time);
+  } else {
+    coordinator->stop_heavy_stopwatch();
+  }
+  in_hook = false;
+}
+
+}  // extern "C"
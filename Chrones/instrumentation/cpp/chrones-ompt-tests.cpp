@@ -0,0 +1,102 @@
+// Copyright 2020-2022 Laurent Cabaret
+// Copyright 2020-2022 Vincent Jacques
+
+// Built and run by 'make test-ompt', with an OpenMP runtime that supports OMPT: see the Makefile
+
+#include <gtest/gtest.h>
+#include <omp.h>
+
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "chrones.hpp"
+
+
+CHRONABLE("chrones-ompt-tests");
+
+namespace {
+
+struct Counts {
+  // Of 'fn_start' events, by label
+  std::map<std::string, int> starts;
+  // Of 'fn_start' minus 'sw_stop' events, by thread
+  std::map<std::string, int> open_scopes;
+};
+
+// Run 'f' with a global coordinator logging into a string, and count the events it logged
+template<typename F>
+Counts run_instrumented(F f) {
+  // The runtime starts the tool on its first use, if Chrones is enabled
+  ::setenv("CHRONES_LOGS_DIRECTORY", ".", 1);
+  chrones::global_log_file_name_prefix() = "chrones-ompt-tests.";
+  std::ostringstream oss;
+  chrones::global_coordinator.reset(new chrones::coordinator(oss));
+  f();
+  chrones::global_coordinator.reset();
+
+  Counts counts;
+  std::istringstream lines(oss.str());
+  std::string line;
+  while (std::getline(lines, line)) {
+    std::vector<std::string> fields;
+    std::istringstream cells(line);
+    std::string cell;
+    while (std::getline(cells, cell, ',')) {
+      fields.push_back(cell);
+    }
+    if (fields[3] == "fn_start") {
+      ++counts.starts[fields[5]];
+      ++counts.open_scopes[fields[1]];
+    } else if (fields[3] == "sw_stop") {
+      --counts.open_scopes[fields[1]];
+    }
+  }
+  return counts;
+}
+
+}  // namespace
+
+
+TEST(ChronesOmptTest, ParallelRegion) {
+  const Counts counts = run_instrumented([]() {
+    #pragma omp parallel num_threads(3)
+    {
+      #pragma omp for schedule(dynamic)
+      for (int i = 0; i < 30; ++i) {}
+    }
+  });
+
+  EXPECT_EQ(counts.starts.at("\"omp parallel\""), 1);
+  EXPECT_EQ(counts.starts.at("\"omp implicit task\""), 3);
+  EXPECT_EQ(counts.starts.at("\"omp for\""), 3);
+  EXPECT_EQ(counts.starts.at("\"omp implicit barrier\""), 1);
+  EXPECT_EQ(counts.open_scopes.size(), 3);
+  for (const auto& open_scopes : counts.open_scopes) {
+    EXPECT_EQ(open_scopes.second, 0) << "thread " << open_scopes.first;
+  }
+}
+
+TEST(ChronesOmptTest, Tasks) {
+  const Counts counts = run_instrumented([]() {
+    #pragma omp parallel num_threads(2)
+    {
+      #pragma omp single
+      {
+        #pragma omp task
+        {}
+        #pragma omp taskwait
+      }
+    }
+  });
+
+  EXPECT_EQ(counts.starts.at("\"omp parallel\""), 1);
+  EXPECT_EQ(counts.starts.at("\"omp implicit task\""), 2);
+  EXPECT_EQ(counts.starts.at("\"omp taskwait\""), 1);
+  EXPECT_EQ(counts.open_scopes.size(), 2);
+  for (const auto& open_scopes : counts.open_scopes) {
+    EXPECT_EQ(open_scopes.second, 0) << "thread " << open_scopes.first;
+  }
+}
@@ -0,0 +1,260 @@
+// Copyright 2020-2022 Laurent Cabaret
+// Copyright 2020-2022 Vincent Jacques
+
+// Automatic instrumentation of OpenMP parallel regions, worksharing constructs and synchronization waits,
+// through the OpenMP Tools Interface (OMPT). Compile and link this file with your program, which must use 'CHRONABLE',
+// and run it with an OpenMP runtime that supports OMPT, e.g. LLVM's 'libomp' (GCC's 'libgomp' doesn't).
+// Constructs are identified by the address of their code; 'chrones report' resolves them to the enclosing function.
+// See the C++ section of the README for details.
+
+#include <omp-tools.h>
+
+#include <cstdlib>
+#include <string>
+
+#include "chrones.hpp"
+
+
+namespace {
+
+// The constructs being executed by the current thread.
+// Their 'start_time' is -1 for those not timed, and 0 for those timed with a heavy stopwatch.
+struct Scope {
+  int64_t start_time;
+  const void* address;
+  const char* label;
+  // For implicit tasks: the thread's number in the team, 0 for the thread that started the parallel region
+  unsigned int thread_number;
+};
+
+const char* const implicit_task_label = "omp implicit task";
+
+const std::size_t max_scopes_depth = 64;
+thread_local Scope scopes[max_scopes_depth];
+thread_local std::size_t scopes_depth = 0;
+
+bool light = false;
+
+// 'address' null to push a scope that is not timed
+void begin_scope(const void* address, const char* label, const unsigned int thread_number = 0) {
+  const std::size_t depth = scopes_depth++;
+  if (depth >= max_scopes_depth) {
+    return;
+  }
+  Scope& scope = scopes[depth];
+  scope.start_time = -1;
+  scope.address = address;
+  scope.label = label;
+  scope.thread_number = thread_number;
+
+  chrones::coordinator* coordinator = chrones::global_coordinator.get();
+  if (!address || !coordinator) {
+    return;
+  }
+  chrones::save_memory_maps();
+  if (light) {
+    scope.start_time = coordinator->start_light_stopwatch();
+  } else {
+    coordinator->start_function_heavy_stopwatch(address, label);
+    scope.start_time = 0;
+  }
+}
+
+void end_scope() {
+  const std::size_t depth = --scopes_depth;
+  if (depth >= max_scopes_depth) {
+    return;
+  }
+  const Scope& scope = scopes[depth];
+  if (scope.start_time == -1) {
+    return;
+  }
+
+  chrones::coordinator* coordinator = chrones::global_coordinator.get();
+  if (!coordinator) {
+    return;
+  }
+  if (light) {
+    coordinator->stop_function_light_stopwatch(scope.address, scope.label, scope.start_time);
+  } else {
+    coordinator->stop_heavy_stopwatch();
+  }
+}
+
+const Scope* get_innermost_scope() {
+  if (scopes_depth == 0 || scopes_depth > max_scopes_depth) {
+    return nullptr;
+  }
+  return &scopes[scopes_depth - 1];
+}
+
+// Identify constructs inside a parallel region by the address of the region: runtimes may not give the address
+// of implicit constructs, or give an address inside themselves (e.g. LLVM's runtime for code compiled by GCC)
+const void* get_address(const void* codeptr_ra, const ompt_data_t* parallel_data) {
+  if (parallel_data != nullptr && parallel_data->ptr != nullptr) {
+    return parallel_data->ptr;
+  }
+  return codeptr_ra;
+}
+
+// The barrier at the end of a parallel region, or, for runtimes implementing OpenMP 5.0, any implicit barrier
+bool is_join_barrier(const ompt_sync_region_t kind) {
+  return
+    kind != ompt_sync_region_barrier_explicit && kind != ompt_sync_region_barrier_implementation
+    && kind != ompt_sync_region_barrier_implicit_workshare
+    && kind != ompt_sync_region_barrier_teams && kind != ompt_sync_region_taskwait
+    && kind != ompt_sync_region_taskgroup && kind != ompt_sync_region_reduction;
+}
+
+const char* get_sync_region_label(const ompt_sync_region_t kind) {
+  switch (kind) {
+    case ompt_sync_region_barrier_explicit:
+    case ompt_sync_region_barrier_implementation:
+      return "omp barrier";
+    case ompt_sync_region_barrier_implicit_workshare:
+    case ompt_sync_region_barrier_implicit_parallel:
+      return "omp implicit barrier";
+    case ompt_sync_region_barrier_teams:
+      return "omp teams barrier";
+    case ompt_sync_region_taskwait:
+      return "omp taskwait";
+    case ompt_sync_region_taskgroup:
+      return "omp taskgroup";
+    case ompt_sync_region_reduction:
+      return "omp reduction";
+    default:
+      // 'ompt_sync_region_barrier' and 'ompt_sync_region_barrier_implicit', deprecated by OpenMP 5.1
+      // but used by runtimes implementing OpenMP 5.0
+      return "omp implicit barrier";
+  }
+}
+
+const char* get_work_label(const ompt_work_t wstype) {
+  switch (wstype) {
+    case ompt_work_loop:
+      return "omp for";
+    case ompt_work_sections:
+      return "omp sections";
+    case ompt_work_taskloop:
+      return "omp taskloop";
+    default:
+      // Including 'single' constructs: LLVM's runtime doesn't report their end for code compiled by GCC.
+      // Their cost is in the barrier that ends them.
+      return nullptr;
+  }
+}
+
+void on_parallel_begin(
+  ompt_data_t*,
+  const ompt_frame_t*,
+  ompt_data_t* parallel_data,
+  unsigned int,
+  int,
+  const void* codeptr_ra
+) {
+  parallel_data->ptr = const_cast<void*>(codeptr_ra);
+  begin_scope(codeptr_ra, "omp parallel");
+}
+
+void on_parallel_end(ompt_data_t*, ompt_data_t*, int, const void*) {
+  end_scope();
+}
+
+// The work of each thread in a parallel region, until it reaches the barrier at the end of the region
+void on_implicit_task(
+  ompt_scope_endpoint_t endpoint,
+  ompt_data_t* parallel_data,
+  ompt_data_t*,
+  unsigned int,
+  unsigned int index,
+  int flags
+) {
+  if (flags & ompt_task_initial) {
+    return;  // The whole program
+  }
+  if (endpoint == ompt_scope_begin) {
+    begin_scope(get_address(nullptr, parallel_data), implicit_task_label, index);
+  } else if (endpoint == ompt_scope_end) {
+    // Unless already ended by 'on_sync_region_wait'
+    const Scope* scope = get_innermost_scope();
+    if (scope && scope->label == implicit_task_label) {
+      end_scope();
+    }
+  }
+}
+
+// Time spent waiting in barriers, by each thread: the direct measure of load imbalance
+void on_sync_region_wait(
+  ompt_sync_region_t kind,
+  ompt_scope_endpoint_t endpoint,
+  ompt_data_t* parallel_data,
+  ompt_data_t*,
+  const void* codeptr_ra
+) {
+  if (endpoint == ompt_scope_begin) {
+    const Scope* scope = get_innermost_scope();
+    if (is_join_barrier(kind) && scope && scope->label == implicit_task_label) {
+      // The barrier at the end of a parallel region. Other threads than the one that started the region
+      // are only released from it when the next region starts, so their wait can't be measured:
+      // the end of their implicit task tells when they reached it.
+      const Scope task = *scope;
+      end_scope();
+      begin_scope(task.thread_number == 0 ? task.address : nullptr, get_sync_region_label(kind));
+    } else {
+      begin_scope(get_address(codeptr_ra, parallel_data), get_sync_region_label(kind));
+    }
+  } else if (endpoint == ompt_scope_end) {
+    end_scope();
+  }
+}
+
+// Each thread's share of a worksharing construct
+void on_work(
+  ompt_work_t wstype,
+  ompt_scope_endpoint_t endpoint,
+  ompt_data_t* parallel_data,
+  ompt_data_t*,
+  uint64_t,
+  const void* codeptr_ra
+) {
+  const char* label = get_work_label(wstype);
+  if (label == nullptr) {
+    return;
+  }
+  if (endpoint == ompt_scope_begin) {
+    begin_scope(get_address(codeptr_ra, parallel_data), label);
+  } else if (endpoint == ompt_scope_end) {
+    end_scope();
+  }
+}
+
+int initialize(ompt_function_lookup_t lookup, int, ompt_data_t*) {
+  const char* stopwatches = std::getenv("CHRONES_OMPT_STOPWATCHES");
+  light = stopwatches && std::string(stopwatches) == "light";
+
+  const ompt_set_callback_t set_callback = reinterpret_cast<ompt_set_callback_t>(lookup("ompt_set_callback"));
+  if (!set_callback) {
+    return 0;
+  }
+  set_callback(ompt_callback_parallel_begin, reinterpret_cast<ompt_callback_t>(&on_parallel_begin));
+  set_callback(ompt_callback_parallel_end, reinterpret_cast<ompt_callback_t>(&on_parallel_end));
+  set_callback(ompt_callback_implicit_task, reinterpret_cast<ompt_callback_t>(&on_implicit_task));
+  set_callback(ompt_callback_sync_region_wait, reinterpret_cast<ompt_callback_t>(&on_sync_region_wait));
+  set_callback(ompt_callback_work, reinterpret_cast<ompt_callback_t>(&on_work));
+  return 1;
+}
+
+void finalize(ompt_data_t*) {}
+
+ompt_start_tool_result_t start_tool_result = {&initialize, &finalize, {0}};
+
+}  // namespace
+
+
+extern "C" ompt_start_tool_result_t* ompt_start_tool(unsigned int, const char*) {
+  // The coordinator may not exist yet: the runtime can start tools before the program's static initialization
+  if (!std::getenv("CHRONES_LOGS_DIRECTORY")) {
+    return nullptr;
+  }
+  return &start_tool_result;
+}
@@ -8,6 +8,8 @@
 #include <chrono>  // NOLINT(build/c++11)
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
 
 #include "chrones.hpp"
 
@@ -54,9 +56,12 @@ class HeavyChronesPerformanceTest : public testing::Test {
   ~HeavyChronesPerformanceTest() {
     delete c;
     const std::string s = oss.str();
-    const int lines = std::count(s.begin(), s.end(), '\n');
+    int stopwatch_events = 0;
+    for (std::string::size_type pos = s.find(",sw_"); pos != std::string::npos; pos = s.find(",sw_", pos + 1)) {
+      ++stopwatch_events;
+    }
     EXPECT_EQ(
-      lines,
+      stopwatch_events,
       2 /* events per stopwatch */
       * STOPWATCHES_PER_REPETITION
       * REPETITIONS);
@@ -138,13 +143,25 @@ TEST_F(HeavyChronesPerformanceTest, ParallelFull) {
 }
 
 
-int get_summary_count(const std::string& s) {
-  std::string::size_type end = std::string::npos;
-  for (int k = 0; k != 6; ++k) {
-    end = s.rfind(',', end - 1);
+// Executions counts of the 'sw_summary' lines for all indexes (i.e. with '-' in their index column)
+std::vector<int> get_summary_counts(const std::string& s) {
+  std::vector<int> counts;
+  std::istringstream iss(s);
+  std::string line;
+  while (std::getline(iss, line)) {
+    // Split from the end: function names can contain commas
+    std::vector<std::string> fields;
+    std::string::size_type end = line.size();
+    for (int k = 0; k != 10; ++k) {
+      const std::string::size_type begin = line.rfind(',', end - 1);
+      fields.push_back(line.substr(begin + 1, end - begin - 1));
+      end = begin;
+    }
+    if (fields[1] == "-") {
+      counts.push_back(std::stoi(fields[9]));
+    }
   }
-  std::string::size_type begin = s.rfind(',', end - 1) + 1;
-  return std::stoi(s.substr(begin, end - begin));
+  return counts;
 }
 
 class LightChronesPerformanceTest : public testing::Test {
@@ -153,7 +170,7 @@ class LightChronesPerformanceTest : public testing::Test {
 
   ~LightChronesPerformanceTest() {
     delete c;
-    EXPECT_EQ(get_summary_count(oss.str()), STOPWATCHES_PER_REPETITION * REPETITIONS);
+    EXPECT_EQ(get_summary_counts(oss.str()), std::vector<int>(1, STOPWATCHES_PER_REPETITION * REPETITIONS));
   }
 
   LightChronesPerformanceTest(const LightChronesPerformanceTest&) = delete;
@@ -274,11 +291,5 @@ TEST(LightChronesPerformanceTest2, SeveralParallel) {
     }
   }
 
-  const std::string s = oss.str();
-  std::string::size_type begin = 0;
-  for (int k = 0; k != 5; ++k) {
-    const std::string::size_type end = s.find('\n', begin + 1);
-    EXPECT_EQ(get_summary_count(s.substr(begin, end - begin + 1)), REPETITIONS * STOPWATCHES_PER_REPETITION / 5);
-    begin = end + 1;
-  }
+  EXPECT_EQ(get_summary_counts(oss.str()), std::vector<int>(5, REPETITIONS * STOPWATCHES_PER_REPETITION / 5));
 }
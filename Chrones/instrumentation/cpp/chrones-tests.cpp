@@ -2,9 +2,19 @@
 // Copyright 2020-2022 Vincent Jacques
 
 #include <gtest/gtest.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <limits>
+#include <mutex>  // NOLINT(build/c++11)
 #include <sstream>
+#include <string>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
 
+// For the 'Levels' test
+#define CHRONES_LEVEL 1
 #include "chrones.hpp"
 
 TEST(ChronesTest, QuoteForCsv) {
@@ -14,6 +24,38 @@ TEST(ChronesTest, QuoteForCsv) {
   EXPECT_EQ(chrones::quote_for_csv("\"def"), "\"\"\"def\"");
 }
 
+TEST(ChronesTest, CsvFormatter) {
+  const int dummy = 0;
+  char label[] = "a\"b";
+
+  std::ostringstream expected;
+  chrones::CsvFormatter formatter;
+  for (const int64_t x : std::vector<int64_t>{
+    0, 7, 10, 99, 100, 12345, -1, -100, std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min(),
+  }) {
+    expected << x << ',';
+    formatter << x << ',';
+  }
+  expected << std::numeric_limits<uint64_t>::max() << ',' << 42u << ',' << -42 << ',';
+  formatter << std::numeric_limits<uint64_t>::max() << ',' << 42u << ',' << -42 << ',';
+  expected << static_cast<const void*>(nullptr) << ',' << static_cast<const void*>(&dummy) << ',';
+  formatter << static_cast<const void*>(nullptr) << ',' << static_cast<const void*>(&dummy) << ',';
+  expected << "abc" << ',' << std::string("def") << '\n';
+  formatter << "abc" << ',' << std::string("def") << '\n';
+  ASSERT_EQ(std::string(formatter.data(), formatter.size()), expected.str());
+
+  formatter.clear();
+  formatter << chrones::csv_quoted(label) << ',' << chrones::csv_quoted(nullptr) << ',';
+  label[2] = 'c';  // Same pointer, different string
+  formatter << chrones::csv_quoted(label) << ',' << chrones::csv_quoted(label);
+  EXPECT_EQ(std::string(formatter.data(), formatter.size()), "\"a\"\"b\",-,\"a\"\"c\",\"a\"\"c\"");
+
+  std::ostringstream oss;
+  formatter.write_to(oss);
+  EXPECT_EQ(oss.str(), "\"a\"\"b\",-,\"a\"\"c\",\"a\"\"c\"");
+  EXPECT_EQ(formatter.size(), 0);
+}
+
 struct MockInfo {
   static int64_t time;
 
@@ -32,11 +74,18 @@ struct MockInfo {
   static std::size_t get_thread_id() {
     return thread_id;
   }
+
+  static int64_t os_thread_id;
+
+  static int64_t get_os_thread_id() {
+    return os_thread_id;
+  }
 };
 
 int64_t MockInfo::time = 0;
 int MockInfo::process_id = 0;
 std::size_t MockInfo::thread_id = 0;
+int64_t MockInfo::os_thread_id = 0;
 
 typedef chrones::heavy_stopwatch_tmpl<MockInfo> heavy_stopwatch;
 typedef chrones::coordinator_tmpl<MockInfo> coordinator;
@@ -56,13 +105,13 @@ inline chrones::labelled_light_stopwatch_tmpl<MockInfo> light_stopwatch(
   return chrones::labelled_light_stopwatch_tmpl<MockInfo>(coordinator, function, label);
 }
 
-inline chrones::labelled_light_stopwatch_tmpl<MockInfo> light_stopwatch(
+inline chrones::indexed_light_stopwatch_tmpl<MockInfo> light_stopwatch(
   coordinator* coordinator,
   const char* function,
   const char* label,
-  int
+  const int index
 ) {
-  return chrones::labelled_light_stopwatch_tmpl<MockInfo>(coordinator, function, label);
+  return chrones::indexed_light_stopwatch_tmpl<MockInfo>(coordinator, function, label, index);
 }
 
 
@@ -72,6 +121,7 @@ TEST(ChronesTest, BasicHeavyOnce) {
     MockInfo::time = 652;
     MockInfo::process_id = 7;
     MockInfo::thread_id = 12;
+    MockInfo::os_thread_id = 4242;
 
     {
       coordinator c(oss);
@@ -84,6 +134,7 @@ TEST(ChronesTest, BasicHeavyOnce) {
 
     ASSERT_EQ(
       oss.str(),
+      "7,12,652,os_thread,4242\n"
       "7,12,652,sw_start,\"f\",-,-\n"
       "7,12,694,sw_stop\n");
   }
@@ -107,7 +158,7 @@ TEST(ChronesTest, BasicLightOnce) {
 
     ASSERT_EQ(
       oss.str(),
-      "7,12,710,sw_summary,\"f\",-,1,42,0,42,42,42,42\n");
+      "7,12,710,sw_summary,\"f\",-,1,42,0,42,42,42,42,42,-,42\n");
   }
 }
 
@@ -116,6 +167,7 @@ TEST(ChronesTest, BasicHeavyFewTimes) {
   MockInfo::time = 122;
   MockInfo::process_id = 8;
   MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
 
   {
     coordinator c(oss);
@@ -129,6 +181,7 @@ TEST(ChronesTest, BasicHeavyFewTimes) {
 
   ASSERT_EQ(
     oss.str(),
+    "8,1,126,os_thread,0\n"
     "8,1,126,sw_start,\"f\",\"label\",1\n"
     "8,1,129,sw_stop\n"
     "8,1,137,sw_start,\"f\",\"label\",2\n"
@@ -142,6 +195,7 @@ TEST(ChronesTest, FlushedBeforeCoordinatorDestruction) {
   MockInfo::time = 0;
   MockInfo::process_id = 0;
   MockInfo::thread_id = 0;
+  MockInfo::os_thread_id = 0;
 
   coordinator c(oss);
   {
@@ -154,6 +208,7 @@ TEST(ChronesTest, FlushedBeforeCoordinatorDestruction) {
   // Data arrives in oss *before* c in destroyed
   ASSERT_EQ(
     oss.str(),
+    "0,0,0,os_thread,0\n"
     "0,0,0,sw_start,\"f\",-,-\n"
     "0,0,0,sw_stop\n");
 }
@@ -163,6 +218,7 @@ TEST(ChronesTest, BasicLightFewTimes) {
   MockInfo::time = 122;
   MockInfo::process_id = 8;
   MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
 
   {
     coordinator c(oss);
@@ -176,7 +232,144 @@ TEST(ChronesTest, BasicLightFewTimes) {
 
   ASSERT_EQ(
     oss.str(),
-    "8,1,200,sw_summary,\"f\",\"l\",3,6,2,3,6,9,18\n");
+    "8,1,200,sw_summary,\"f\",\"l\",3,6,2,3,6,9,18,18,-,9\n"
+    "8,1,200,sw_summary,\"f\",\"l\",1,3,0,3,3,3,3,3,1,3\n"
+    "8,1,200,sw_summary,\"f\",\"l\",1,6,0,6,6,6,6,6,2,6\n"
+    "8,1,200,sw_summary,\"f\",\"l\",1,9,0,9,9,9,9,9,3,9\n");
+}
+
+TEST(ChronesTest, LightIndexesOverflow) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.light_stopwatch_indexes = 2;
+
+  {
+    coordinator c(oss, settings);
+    for (int i : {5, 3, 5, 7, 3, 9}) {
+      auto t = light_stopwatch(&c, "f", "l", i);
+      MockInfo::time += i;
+    }
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,32,sw_summary,\"f\",\"l\",6,5,2,3,5,9,32,32,-,9\n"
+    "8,1,32,sw_summary,\"f\",\"l\",2,3,0,3,3,3,6,6,3,3\n"
+    "8,1,32,sw_summary,\"f\",\"l\",2,5,0,5,5,5,10,10,5,5\n"
+    "8,1,32,sw_summary,\"f\",\"l\",2,8,1,7,9,9,16,16,+,9\n");
+}
+
+TEST(ChronesTest, NestedLight) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  // In a single array so that summaries (sorted by pointer) are in a known order
+  const char functions[2][2] = {"f", "g"};
+
+  {
+    coordinator c(oss);
+    {
+      auto f = light_stopwatch(&c, functions[0]);
+      MockInfo::time = 10;
+      {
+        auto g = light_stopwatch(&c, functions[1]);
+        MockInfo::time = 40;
+      }
+      MockInfo::time = 50;
+      {
+        auto g = light_stopwatch(&c, functions[1]);
+        MockInfo::time = 60;
+      }
+      MockInfo::time = 100;
+    }
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,100,sw_summary,\"f\",-,1,100,0,100,100,100,100,60,-,100\n"
+    "8,1,100,sw_summary,\"g\",-,2,20,10,10,30,30,40,40,-,30\n");
+}
+
+TEST(ChronesTest, MovedLight) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+
+  {
+    coordinator c(oss);
+    {
+      auto f = light_stopwatch(&c, "f");
+      MockInfo::time = 10;
+      auto g = std::move(f);
+      MockInfo::time = 30;
+    }
+  }
+
+  ASSERT_EQ(oss.str(), "8,1,30,sw_summary,\"f\",-,1,30,0,30,30,30,30,30,-,30\n");
+}
+
+TEST(ChronesTest, HeavyWork) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+
+  {
+    coordinator c(oss);
+    {
+      auto t = heavy_stopwatch(&c, "f");
+      t.set_work(1048576);
+      MockInfo::time = 10;
+    }
+    {
+      auto t = heavy_stopwatch(&c, "f");
+      t.set_work(0.5);
+      MockInfo::time = 20;
+    }
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,0,os_thread,0\n"
+    "8,1,0,sw_start,\"f\",-,-\n"
+    "8,1,10,sw_stop,1048576\n"
+    "8,1,10,sw_start,\"f\",-,-\n"
+    "8,1,20,sw_stop,0.5\n");
+}
+
+TEST(ChronesTest, LightWork) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+
+  {
+    coordinator c(oss);
+    for (int duration : {10, 20, 40}) {
+      auto t = light_stopwatch(&c, "f");
+      t.set_work(100);
+      MockInfo::time += duration;
+    }
+    {
+      // Not accounted for in throughputs
+      auto t = light_stopwatch(&c, "f");
+      MockInfo::time += 30;
+    }
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,100,sw_summary,\"f\",-,4,25,11,10,30,40,100,100,-,40,3,300,4285714176,2500000000,5000000000,2500000000\n");
 }
 
 TEST(ChronesTest, LabelWithQuotes) {
@@ -184,6 +377,7 @@ TEST(ChronesTest, LabelWithQuotes) {
   MockInfo::time = 0;
   MockInfo::process_id = 0;
   MockInfo::thread_id = 0;
+  MockInfo::os_thread_id = 0;
 
   {
     coordinator c(oss);
@@ -192,6 +386,7 @@ TEST(ChronesTest, LabelWithQuotes) {
 
   ASSERT_EQ(
     oss.str(),
+    "0,0,0,os_thread,0\n"
     "0,0,0,sw_start,\"f\",\"a 'label' with \"\"quotes\"\"\",-\n"
     "0,0,0,sw_stop\n");
 }
@@ -201,6 +396,7 @@ TEST(ChronesTest, Index) {
   MockInfo::time = 0;
   MockInfo::process_id = 0;
   MockInfo::thread_id = 0;
+  MockInfo::os_thread_id = 0;
 
   {
     coordinator c(oss);
@@ -209,6 +405,7 @@ TEST(ChronesTest, Index) {
 
   ASSERT_EQ(
     oss.str(),
+    "0,0,0,os_thread,0\n"
     "0,0,0,sw_start,\"f\",\"label\",42\n"
     "0,0,0,sw_stop\n");
 }
@@ -222,3 +419,540 @@ TEST(ChronesTest, NullCoordinator) {
   light_stopwatch(nullptr, "name", "label");
   light_stopwatch(nullptr, "name", "label", 42);
 }
+
+TEST(ChronesTest, PeriodicSummaries) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.summary_interval = std::chrono::milliseconds(1);
+
+  {
+    coordinator c(oss, settings);
+    {
+      auto t = light_stopwatch(&c, "f");
+      MockInfo::time = 10;
+    }
+    // Let the worker log the first window
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    MockInfo::time = 20;
+    {
+      auto t = light_stopwatch(&c, "f");
+      MockInfo::time = 25;
+    }
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,10,sw_summary,\"f\",-,1,10,0,10,10,10,10,10,-,10\n"
+    "8,1,25,sw_summary,\"f\",-,1,5,0,5,5,5,5,5,-,5\n");
+}
+
+TEST(ChronesTest, ClockOffset) {
+  std::ostringstream oss;
+  MockInfo::time = 5;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.clock_offset = std::chrono::microseconds(-1500);
+
+  {
+    coordinator c(oss, settings);
+    auto t = heavy_stopwatch(&c, "f");
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,5,clock_offset,-1500000\n"
+    "8,1,5,os_thread,0\n"
+    "8,1,5,sw_start,\"f\",-,-\n"
+    "8,1,5,sw_stop\n");
+}
+
+TEST(ChronesTest, FlightRecorder) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.flight_recorder_events = 3;
+
+  {
+    coordinator c(oss, settings);
+    {
+      auto f = heavy_stopwatch(&c, "f");
+      MockInfo::time = 10;
+      for (int i = 0; i != 2; ++i) {
+        auto g = heavy_stopwatch(&c, "g");
+        MockInfo::time += 10;
+      }
+      auto h = heavy_stopwatch(&c, "h");
+      MockInfo::time = 40;
+      // The ring has overwritten the starts of 'f' and of the first 'g'
+      c.dump_flight_recorder();
+      MockInfo::time = 50;
+    }
+    // Not logged: the flight recorder is not dumped again
+    auto k = heavy_stopwatch(&c, "k");
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,0,os_thread,0\n"
+    // Unpaired stop of the first 'g': not logged
+    "8,1,20,sw_start,\"g\",-,-\n"
+    "8,1,30,sw_stop\n"
+    "8,1,30,sw_start,\"h\",-,-\n"
+    // Stop of 'h', logged even if overwritten, because its start was. The stop of 'f' is not logged.
+    "8,1,50,sw_stop\n");
+}
+
+TEST(ChronesTest, FlightRecorderThreshold) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.flight_recorder_events = 100;
+  settings.flight_recorder_threshold = std::chrono::nanoseconds(20);
+
+  {
+    coordinator c(oss, settings);
+    {
+      auto f = heavy_stopwatch(&c, "f");
+      MockInfo::time = 10;
+    }
+    {
+      auto l = light_stopwatch(&c, "l");
+      MockInfo::time = 30;
+    }
+    {
+      auto g = heavy_stopwatch(&c, "g");
+      MockInfo::time = 40;
+    }
+    {
+      auto h = heavy_stopwatch(&c, "h");
+      MockInfo::time = 70;
+    }
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,0,os_thread,0\n"
+    // Dumped when 'l' stopped
+    "8,1,0,sw_start,\"f\",-,-\n"
+    "8,1,10,sw_stop\n"
+    // Dumped when 'h' stopped
+    "8,1,30,sw_start,\"g\",-,-\n"
+    "8,1,40,sw_stop\n"
+    "8,1,40,sw_start,\"h\",-,-\n"
+    "8,1,70,sw_stop\n"
+    "8,1,70,sw_summary,\"l\",-,1,20,0,20,20,20,20,20,-,20\n");
+}
+
+TEST(ChronesTest, ExemplarsAboveThreshold) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.exemplars_per_site = 2;
+  settings.exemplars_threshold = std::chrono::nanoseconds(15);
+  // In a single array so that summaries (sorted by pointer) are in a known order
+  const char functions[2][2] = {"f", "g"};
+
+  {
+    coordinator c(oss, settings);
+    for (int duration : {10, 20, 30, 40}) {
+      auto f = light_stopwatch(&c, functions[0]);
+      MockInfo::time += duration;
+    }
+    {
+      auto g = light_stopwatch(&c, functions[1], "l", 3);
+      MockInfo::time += 50;
+    }
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,30,os_thread,0\n"
+    "8,1,30,sw_exemplar,\"f\",-,-,20\n"
+    "8,1,60,sw_exemplar,\"f\",-,-,30\n"
+    "8,1,150,sw_exemplar,\"g\",\"l\",3,50\n"
+    "8,1,150,sw_summary,\"f\",-,4,25,11,10,30,40,100,100,-,40\n"
+    "8,1,150,sw_summary,\"g\",\"l\",1,50,0,50,50,50,50,50,-,50\n"
+    "8,1,150,sw_summary,\"g\",\"l\",1,50,0,50,50,50,50,50,3,50\n");
+}
+
+TEST(ChronesTest, ExemplarsAbovePercentile99) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.exemplars_per_site = 10;
+
+  {
+    coordinator c(oss, settings);
+    for (int i = 0; i != 300; ++i) {
+      auto f = light_stopwatch(&c, "f");
+      // Slow executions: the first one happens before the percentile is known (after 128 executions)
+      MockInfo::time += (i == 50 || i == 200) ? 1000 : i % 10 + 1;
+    }
+  }
+
+  std::vector<std::string> exemplars;
+  std::istringstream iss(oss.str());
+  std::string line;
+  while (std::getline(iss, line)) {
+    if (line.find("sw_exemplar") != std::string::npos) {
+      exemplars.push_back(line);
+    }
+  }
+  ASSERT_EQ(exemplars.size(), 1);
+  ASSERT_EQ(exemplars[0], "8,1,3099,sw_exemplar,\"f\",-,-,1000");
+}
+
+TEST(ChronesTest, FlightRecorderThreadChurn) {
+  std::ostringstream oss;
+  chrones::CoordinatorSettings settings;
+  settings.flight_recorder_events = 10;
+
+  coordinator c(oss, settings);
+
+  // Exited threads give their rings back
+  for (int i = 0; i != 1000; ++i) {
+    std::thread t([&c]() { auto f = heavy_stopwatch(&c, "f"); });
+    t.join();
+  }
+  EXPECT_EQ(c.flight_recorder_rings(), 1);
+
+  // Simultaneous threads need their own rings, but don't accumulate them
+  for (int i = 0; i != 250; ++i) {
+    std::vector<std::thread> threads;
+    for (int j = 0; j != 8; ++j) {
+      threads.emplace_back([&c]() { auto f = heavy_stopwatch(&c, "f"); });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+  EXPECT_LE(c.flight_recorder_rings(), 16);
+}
+
+TEST(ChronesTest, BlockLog) {
+  std::ostringstream oss;
+  MockInfo::time = 5;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 300;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.log_block_size = 1024;
+
+  {
+    coordinator c(oss, settings);
+    auto t = heavy_stopwatch(&c, "f");
+    MockInfo::time = 15;
+  }
+
+  const char expected[] =
+    // Header
+    "CHRB" "\x00" "\x30\x00\x00\x00" "\x30\x00\x00\x00" "\x03\x00\x00\x00" "\x08\x00\x00\x00"
+    "\x05\x00\x00\x00\x00\x00\x00\x00" "\x0F\x00\x00\x00\x00\x00\x00\x00"
+    // New thread in slot 0, with id 300, at time 5
+    "\x00" "\xAC\x02" "\x0A" "\x0C" ",os_thread,0"
+    // Thread in slot 0, same time
+    "\x00" "\x00" "\x11" ",sw_start,\"f\",-,-"
+    // Thread in slot 0, 10ns later
+    "\x00" "\x14" "\x08" ",sw_stop";
+  ASSERT_EQ(oss.str(), std::string(expected, sizeof(expected) - 1));
+}
+
+TEST(ChronesTest, Telemetry) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.telemetry = true;
+
+  {
+    coordinator c(oss, settings);
+    auto t = heavy_stopwatch(&c, "f");
+    MockInfo::time = 10;
+  }
+
+  const std::string s = oss.str();
+  const std::string expected_begin =
+    "8,1,0,os_thread,0\n"
+    "8,1,0,sw_start,\"f\",-,-\n"
+    "8,1,10,sw_stop\n"
+    "8,1,10,telemetry,3,";
+  ASSERT_EQ(s.substr(0, expected_begin.size()), expected_begin);
+  // Other values depend on timing
+  ASSERT_EQ(std::count(s.begin() + expected_begin.size(), s.end(), ','), 7);
+}
+
+TEST(ChronesTest, Fork) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+
+  int pipe_fds[2];
+  ASSERT_EQ(pipe(pipe_fds), 0);
+  pid_t pid;
+  {
+    coordinator c(oss);
+    {
+      auto f = heavy_stopwatch(&c, "f");
+      auto l = light_stopwatch(&c, "l");
+      MockInfo::time = 10;
+
+      c.prepare_fork();
+      pid = fork();
+      ASSERT_NE(pid, -1);
+      if (pid == 0) {
+        MockInfo::process_id = 9;
+        oss.str("");  // Like 'after_fork_in_child' in 'make_global_coordinator' reopens the log file
+        c.after_fork_in_child();
+      } else {
+        c.after_fork_in_parent();
+      }
+
+      auto g = heavy_stopwatch(&c, "g");
+      MockInfo::time = 20;
+    }
+  }
+
+  if (pid == 0) {
+    const std::string s = oss.str();
+    ssize_t written = write(pipe_fds[1], s.data(), s.size());
+    _exit(written == static_cast<ssize_t>(s.size()) ? 0 : 1);
+  }
+
+  close(pipe_fds[1]);
+  std::string child_output;
+  char buffer[1024];
+  ssize_t size;
+  while ((size = read(pipe_fds[0], buffer, sizeof(buffer))) > 0) {
+    child_output.append(buffer, size);
+  }
+  close(pipe_fds[0]);
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,0,os_thread,0\n"
+    "8,1,0,sw_start,\"f\",-,-\n"
+    "8,1,10,sw_start,\"g\",-,-\n"
+    "8,1,20,sw_stop\n"
+    "8,1,20,sw_stop\n"
+    "8,1,20,sw_summary,\"l\",-,1,20,0,20,20,20,20,20,-,20\n");
+  // The child doesn't log the stop of 'f', started by the parent, and logs the whole duration of 'l'
+  ASSERT_EQ(
+    child_output,
+    "9,1,10,os_thread,0\n"
+    "9,1,10,sw_start,\"g\",-,-\n"
+    "9,1,20,sw_stop\n"
+    "9,1,20,sw_summary,\"l\",-,1,20,0,20,20,20,20,20,-,20\n");
+}
+
+TEST(ChronesTest, ForkClockOffset) {
+  std::ostringstream oss;
+  MockInfo::time = 0;
+  MockInfo::process_id = 8;
+  MockInfo::thread_id = 1;
+  MockInfo::os_thread_id = 0;
+  chrones::CoordinatorSettings settings;
+  settings.clock_offset = std::chrono::microseconds(-1500);
+
+  int pipe_fds[2];
+  ASSERT_EQ(pipe(pipe_fds), 0);
+  pid_t pid;
+  {
+    coordinator c(oss, settings);
+    MockInfo::time = 10;
+
+    c.prepare_fork();
+    pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+      MockInfo::process_id = 9;
+      oss.str("");  // Like 'after_fork_in_child' in 'make_global_coordinator' reopens the log file
+      c.after_fork_in_child();
+    } else {
+      c.after_fork_in_parent();
+    }
+
+    auto f = heavy_stopwatch(&c, "f");
+    MockInfo::time = 20;
+  }
+
+  if (pid == 0) {
+    const std::string s = oss.str();
+    ssize_t written = write(pipe_fds[1], s.data(), s.size());
+    _exit(written == static_cast<ssize_t>(s.size()) ? 0 : 1);
+  }
+
+  close(pipe_fds[1]);
+  std::string child_output;
+  char buffer[1024];
+  ssize_t size;
+  while ((size = read(pipe_fds[0], buffer, sizeof(buffer))) > 0) {
+    child_output.append(buffer, size);
+  }
+  close(pipe_fds[0]);
+  int status;
+  ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(WEXITSTATUS(status), 0);
+
+  ASSERT_EQ(
+    oss.str(),
+    "8,1,0,clock_offset,-1500000\n"
+    "8,1,10,os_thread,0\n"
+    "8,1,10,sw_start,\"f\",-,-\n"
+    "8,1,20,sw_stop\n");
+  ASSERT_EQ(
+    child_output,
+    "9,1,10,clock_offset,-1500000\n"
+    "9,1,10,os_thread,0\n"
+    "9,1,10,sw_start,\"f\",-,-\n"
+    "9,1,20,sw_stop\n");
+}
+
+// Busy on the first attempt to acquire it, and then takes 20 ns to acquire
+struct ContendedOnceLockable {
+  ContendedOnceLockable() : busy(true) {}
+
+  bool try_lock() {
+    const bool acquired = !busy;
+    busy = false;
+    return acquired;
+  }
+
+  void lock() {
+    busy = false;
+    MockInfo::time += 20;
+  }
+
+  void unlock() {}
+
+  bool busy;
+};
+
+TEST(ChronesTest, Mutex) {
+  std::ostringstream oss;
+  MockInfo::time = 100;
+  MockInfo::process_id = 10;
+  MockInfo::thread_id = 1;
+
+  {
+    coordinator c(oss);
+    chrones::mutex_tmpl<MockInfo, ContendedOnceLockable> m(&c, "m");
+    {
+      std::lock_guard<chrones::mutex_tmpl<MockInfo, ContendedOnceLockable>> guard(m);  // Waits 20 ns
+      MockInfo::time += 30;
+    }
+    {
+      std::lock_guard<chrones::mutex_tmpl<MockInfo, ContendedOnceLockable>> guard(m);
+      MockInfo::time += 10;
+    }
+    ASSERT_TRUE(m.try_lock());
+    MockInfo::time += 50;
+    m.unlock();
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "10,1,210,lock_summary,\"m\",exclusive,3,1,20,20,90,50,50\n");
+}
+
+TEST(ChronesTest, SharedMutex) {
+  std::ostringstream oss;
+  MockInfo::time = 100;
+  MockInfo::process_id = 10;
+  MockInfo::thread_id = 1;
+
+  {
+    coordinator c(oss);
+    chrones::shared_mutex_tmpl<MockInfo> m1(&c, "m1");
+    chrones::shared_mutex_tmpl<MockInfo> m2(&c, "m2");
+    m1.lock_shared();
+    MockInfo::time += 10;
+    m2.lock_shared();
+    MockInfo::time += 10;
+    ASSERT_TRUE(m1.try_lock_shared());
+    MockInfo::time += 10;
+    m1.unlock_shared();  // Released in another order than acquired
+    MockInfo::time += 10;
+    m2.unlock_shared();
+    MockInfo::time += 10;
+    m1.unlock_shared();
+  }
+
+  // Summaries are not sorted by name
+  const std::string m1 = "10,1,150,lock_summary,\"m1\",shared,2,0,0,0,60,50,50\n";
+  const std::string m2 = "10,1,150,lock_summary,\"m2\",shared,1,0,0,0,30,30,30\n";
+  ASSERT_TRUE(oss.str() == m1 + m2 || oss.str() == m2 + m1) << oss.str();
+}
+
+TEST(ChronesTest, SharedMutexExclusively) {
+  std::ostringstream oss;
+  MockInfo::time = 100;
+  MockInfo::process_id = 10;
+  MockInfo::thread_id = 1;
+
+  {
+    coordinator c(oss);
+    chrones::shared_mutex_tmpl<MockInfo> m(&c, "m");
+    {
+      std::lock_guard<chrones::shared_mutex_tmpl<MockInfo>> guard(m);
+      MockInfo::time += 30;
+    }
+  }
+
+  ASSERT_EQ(
+    oss.str(),
+    "10,1,130,lock_summary,\"m\",exclusive,1,0,0,0,30,30,30\n");
+}
+
+TEST(ChronesTest, MutexWithNullCoordinator) {
+  chrones::mutex_tmpl<MockInfo, std::mutex> m(nullptr, "m");
+  std::lock_guard<chrones::mutex_tmpl<MockInfo, std::mutex>> guard(m);
+  chrones::shared_mutex_tmpl<MockInfo> s(nullptr, "s");
+  s.lock_shared();
+  s.unlock_shared();
+}
+
+#define STRINGIFY(...) #__VA_ARGS__
+#define EXPAND_AND_STRINGIFY(...) STRINGIFY(__VA_ARGS__)
+
+TEST(ChronesTest, Levels) {
+  EXPECT_EQ(
+    std::string(EXPAND_AND_STRINGIFY(CHRONE_L(1, "label", 42))),
+    EXPAND_AND_STRINGIFY(CHRONE("label", 42)));
+  EXPECT_EQ(std::string(EXPAND_AND_STRINGIFY(CHRONE_L(0))), EXPAND_AND_STRINGIFY(CHRONE()));
+  EXPECT_EQ(std::string(EXPAND_AND_STRINGIFY(CHRONE_L(2, "label"))), "");
+  EXPECT_EQ(
+    std::string(EXPAND_AND_STRINGIFY(MINICHRONE_L(1, "label"))),
+    EXPAND_AND_STRINGIFY(MINICHRONE("label")));
+  EXPECT_EQ(std::string(EXPAND_AND_STRINGIFY(MINICHRONE_L(9))), "");
+  EXPECT_EQ(
+    std::string(EXPAND_AND_STRINGIFY(CHRONES_SET_WORK_L(1, 1024))),
+    EXPAND_AND_STRINGIFY(CHRONES_SET_WORK(1024)));
+  EXPECT_EQ(std::string(EXPAND_AND_STRINGIFY(CHRONES_SET_WORK_L(2, 1024))), "");
+}
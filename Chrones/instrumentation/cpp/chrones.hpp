@@ -4,6 +4,47 @@
 #ifndef CHRONES_HPP_
 #define CHRONES_HPP_
 
+#include <pthread.h>
+
+#include <mutex>  // NOLINT(build/c++11)
+
+
+namespace chrones {
+
+// Reader-writer lock, for C++11 which has no 'std::shared_mutex'.
+// Usable with 'std::unique_lock', and with 'std::shared_lock' since C++14.
+class rwlock {
+ public:
+  rwlock() : _lock() {
+    ::pthread_rwlock_init(&_lock, nullptr);
+  }
+
+  ~rwlock() {
+    ::pthread_rwlock_destroy(&_lock);
+  }
+
+  rwlock(const rwlock&) = delete;
+  rwlock& operator=(const rwlock&) = delete;
+
+ public:
+  void lock() { ::pthread_rwlock_wrlock(&_lock); }
+
+  bool try_lock() { return ::pthread_rwlock_trywrlock(&_lock) == 0; }
+
+  void unlock() { ::pthread_rwlock_unlock(&_lock); }
+
+  void lock_shared() { ::pthread_rwlock_rdlock(&_lock); }
+
+  bool try_lock_shared() { return ::pthread_rwlock_tryrdlock(&_lock) == 0; }
+
+  void unlock_shared() { ::pthread_rwlock_unlock(&_lock); }
+
+ private:
+  pthread_rwlock_t _lock;
+};
+
+}  // namespace chrones
+
 #ifdef CHRONES_DISABLED
 
 #define CHRONABLE(name)
@@ -12,25 +53,58 @@
 
 #define MINICHRONE(...)
 
+#define CHRONE_L(...)
+
+#define MINICHRONE_L(...)
+
+#define CHRONES_SET_WORK(...)
+
+#define CHRONES_SET_WORK_L(...)
+
+#define CHRONES_DUMP_FLIGHT_RECORDER()
+
+namespace chrones {
+
+class mutex : public std::mutex {
+ public:
+  explicit mutex(const char*) {}
+};
+
+class shared_mutex : public rwlock {
+ public:
+  explicit shared_mutex(const char*) {}
+};
+
+}  // namespace chrones
+
 #else
 
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef CHRONES_USE_ZLIB
+#include <zlib.h>
+#endif
 
 #include <algorithm>
 #include <atomic>
 #include <chrono>  // NOLINT(build/c++11)
 #include <cmath>
+#include <csignal>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iterator>
 #include <limits>
 #include <map>
 #include <memory>
-#include <mutex>  // NOLINT(build/c++11)
-#include <sstream>
+#include <ostream>
 #include <string>
 #include <thread>  // NOLINT(build/c++11)
 #include <tuple>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -48,12 +122,22 @@ class StreamStatistics {
     _min(std::numeric_limits<float>::max()),
     _max(-std::numeric_limits<float>::max()),
     _sum(),
+    _self_sum(),
     _m2n(),
-    _samples()
+    _samples(),
+    _work_count(0),
+    _work_sum(),
+    _work_duration_sum(),
+    _throughputs()
   {}
 
  public:
   void update(const float x) {
+    update(x, x);
+  }
+
+  // 'self_x' is the part of 'x' not spent in nested stopwatches
+  void update(const float x, const float self_x) {
     // Trivial updates
     _min = std::min(_min, x);
     _max = std::max(_max, x);
@@ -64,6 +148,7 @@ class StreamStatistics {
     const float delta_1 = x - mean();
     // Accumulate in double
     _sum += x;
+    _self_sum += self_x;
     // Count in uint64
     _count += 1;
     if (_count >= 2) {
@@ -73,6 +158,17 @@ class StreamStatistics {
     }
   }
 
+  // 'work' is the amount of work (e.g. bytes or items) done in 'x' nanoseconds, NaN if unknown
+  void update(const float x, const float self_x, const double work) {
+    update(x, self_x);
+    if (!std::isnan(work)) {
+      ++_work_count;
+      _work_sum += work;
+      _work_duration_sum += x;
+      _throughputs.push_back(x > 0 ? work * 1e9 / x : std::numeric_limits<float>::infinity());
+    }
+  }
+
  public:
   uint64_t count() const { return _count; }
 
@@ -94,20 +190,58 @@ class StreamStatistics {
     }
   }
 
+  // 'q' in [0, 1]. Like 'median', returns a sample: no interpolation
+  float quantile(const float q) const {
+    return select_quantile(&_samples, q);
+  }
+
   float max() const { return _max; }
 
   float sum() const { return _sum; }
 
+  float self_sum() const { return _self_sum; }
+
+  // Throughputs, in work per second, of the updates with a known amount of work
+  uint64_t work_count() const { return _work_count; }
+
+  double work_sum() const { return _work_sum; }
+
+  // Weighted by durations: the total work divided by the total duration
+  float throughput_mean() const { return _work_sum * 1e9 / _work_duration_sum; }
+
+  float throughput_quantile(const float q) const {
+    return select_quantile(&_throughputs, q);
+  }
+
+ private:
+  static float select_quantile(std::vector<float>* samples, const float q) {
+    if (samples->empty()) {
+      return NAN;
+    } else {
+      auto nth = samples->begin() + std::min(
+        samples->size() - 1,
+        static_cast<std::size_t>(q * samples->size()));
+      std::nth_element(samples->begin(), nth, samples->end());
+      return *nth;
+    }
+  }
+
  private:
   uint64_t _count;
   float _min;
   float _max;
   double _sum;
+  double _self_sum;
   double _m2n;
 
   // Temporary, for median, until we
   // @todo(later) implement binapprox (https://www.stat.cmu.edu/~ryantibs/median/)
   mutable std::vector<float> _samples;
+
+  uint64_t _work_count;
+  double _work_sum;
+  double _work_duration_sum;
+  mutable std::vector<float> _throughputs;
 };
 
 // The default CSV dialect used by Python's `csv` module interprets two double-quote characters
@@ -123,11 +257,256 @@ inline std::string quote_for_csv(std::string s) {
   return "\"" + s + "\"";
 }
 
+// Amounts of work and throughputs are not integers like times: 15 significant digits, exact for integers up to 2^49
+inline std::string format_number(const double x) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.15g", x);
+  return buffer;
+}
+
+// Writes CSV into a reusable buffer, producing the same bytes as 'std::ostream' would for the types it accepts,
+// but without its per-field overhead (sentry, locale, virtual calls). Strings are quoted once per distinct pointer.
+class CsvFormatter {
+ public:
+  // Written like 'quote_for_csv(value)', or "-" if 'value' is null. See 'csv_quoted'.
+  struct Quoted {
+    const char* value;
+  };
+
+  CsvFormatter() : _buffer(), _quoted() {}
+
+  CsvFormatter(const CsvFormatter&) = delete;
+  CsvFormatter& operator=(const CsvFormatter&) = delete;
+
+ public:
+  const char* data() const { return _buffer.data(); }
+
+  std::size_t size() const { return _buffer.size(); }
+
+  void clear() { _buffer.clear(); }
+
+  // Write the buffer in a single call, and clear it (keeping its capacity)
+  void write_to(std::ostream& stream) {
+    stream.write(_buffer.data(), _buffer.size());
+    _buffer.clear();
+  }
+
+  CsvFormatter& operator<<(const char c) {
+    _buffer.push_back(c);
+    return *this;
+  }
+
+  CsvFormatter& operator<<(const char* s) {
+    _buffer.append(s);
+    return *this;
+  }
+
+  CsvFormatter& operator<<(const std::string& s) {
+    _buffer.append(s);
+    return *this;
+  }
+
+  template<typename Integer>
+  typename std::enable_if<std::is_integral<Integer>::value, CsvFormatter&>::type operator<<(const Integer x) {
+    put_integer(x, std::is_signed<Integer>());
+    return *this;
+  }
+
+  // Like 'std::ostream': lowercase hexadecimal with a "0x" prefix, and "0" for null
+  CsvFormatter& operator<<(const void* p) {
+    uint64_t x = reinterpret_cast<uintptr_t>(p);
+    if (x == 0) {
+      _buffer.push_back('0');
+      return *this;
+    }
+    char buffer[18];
+    char* const end = buffer + sizeof(buffer);
+    char* begin = end;
+    while (x != 0) {
+      *--begin = "0123456789abcdef"[x & 0xF];
+      x >>= 4;
+    }
+    *--begin = 'x';
+    *--begin = '0';
+    _buffer.append(begin, end);
+    return *this;
+  }
+
+  CsvFormatter& operator<<(const Quoted s) {
+    if (s.value == nullptr) {
+      _buffer.push_back('-');
+      return *this;
+    }
+    const auto quoted = _quoted.find(s.value);
+    // The same pointer may be reused for a different string, e.g. by a 'std::string' freed after its events are flushed
+    if (quoted != _quoted.end() && std::strcmp(quoted->second.original.c_str(), s.value) == 0) {
+      _buffer.append(quoted->second.quoted);
+    } else if (quoted == _quoted.end() && _quoted.size() >= max_quoted_strings) {
+      _buffer.append(quote_for_csv(s.value));
+    } else {
+      QuotedString& cached = _quoted[s.value];
+      cached.original = s.value;
+      cached.quoted = quote_for_csv(s.value);
+      _buffer.append(cached.quoted);
+    }
+    return *this;
+  }
+
+ private:
+  template<typename Integer>
+  void put_integer(const Integer x, std::true_type /* is_signed */) {
+    if (x < 0) {
+      _buffer.push_back('-');
+      put_decimal(0 - static_cast<uint64_t>(x));
+    } else {
+      put_decimal(static_cast<uint64_t>(x));
+    }
+  }
+
+  template<typename Integer>
+  void put_integer(const Integer x, std::false_type /* is_signed */) {
+    put_decimal(static_cast<uint64_t>(x));
+  }
+
+  // Two digits per division
+  void put_decimal(uint64_t x) {
+    static const char digits_pairs[] =
+      "00010203040506070809"
+      "10111213141516171819"
+      "20212223242526272829"
+      "30313233343536373839"
+      "40414243444546474849"
+      "50515253545556575859"
+      "60616263646566676869"
+      "70717273747576777879"
+      "80818283848586878889"
+      "90919293949596979899";
+    char buffer[20];
+    char* const end = buffer + sizeof(buffer);
+    char* begin = end;
+    while (x >= 100) {
+      const std::size_t pair = 2 * (x % 100);
+      x /= 100;
+      *--begin = digits_pairs[pair + 1];
+      *--begin = digits_pairs[pair];
+    }
+    if (x >= 10) {
+      *--begin = digits_pairs[2 * x + 1];
+      *--begin = digits_pairs[2 * x];
+    } else {
+      *--begin = static_cast<char>('0' + x);
+    }
+    _buffer.append(begin, end);
+  }
+
+ private:
+  struct QuotedString {
+    QuotedString() : original(), quoted() {}
+
+    std::string original;
+    std::string quoted;
+  };
+
+  // Strings with other pointers are quoted each time they are written
+  static const std::size_t max_quoted_strings = 4096;
+
+  std::string _buffer;
+  std::map<const char*, QuotedString> _quoted;
+};
+
+inline CsvFormatter::Quoted csv_quoted(const char* s) {
+  return CsvFormatter::Quoted{s};
+}
+
 template<class T, class... Args>
 std::unique_ptr<T> make_unique(Args&&... args) {
   return std::unique_ptr<T>(new T(std::forward<Args>(args)...));
 }
 
+inline std::size_t get_size_from_environment(const char* name, const std::size_t default_value) {
+  const char* const value = std::getenv(name);
+  if (value == nullptr || *value == '\0') {
+    return default_value;
+  }
+  return std::strtoull(value, nullptr, 10);
+}
+
+inline std::chrono::nanoseconds get_seconds_from_environment(const char* name, const std::chrono::nanoseconds default_value) {
+  const char* const value = std::getenv(name);
+  if (value == nullptr || *value == '\0') {
+    return default_value;
+  }
+  return std::chrono::nanoseconds(static_cast<int64_t>(std::strtod(value, nullptr) * 1e9));
+}
+
+struct CoordinatorSettings {
+  CoordinatorSettings() :
+    light_stopwatch_indexes(16),
+    summary_interval(0),
+    clock_offset(0),
+    flight_recorder_events(0),
+    flight_recorder_threshold(0),
+    exemplars_per_site(0),
+    exemplars_threshold(0),
+    log_block_size(0),
+    telemetry(false)
+  {}
+
+  static CoordinatorSettings from_environment() {
+    CoordinatorSettings settings;
+    settings.light_stopwatch_indexes =
+      get_size_from_environment("CHRONES_LIGHT_STOPWATCH_INDEXES", settings.light_stopwatch_indexes);
+    settings.summary_interval =
+      get_seconds_from_environment("CHRONES_SUMMARY_INTERVAL", settings.summary_interval);
+    settings.clock_offset =
+      get_seconds_from_environment("CHRONES_CLOCK_OFFSET", settings.clock_offset);
+    settings.flight_recorder_events =
+      get_size_from_environment("CHRONES_FLIGHT_RECORDER_EVENTS", settings.flight_recorder_events);
+    settings.flight_recorder_threshold =
+      get_seconds_from_environment("CHRONES_FLIGHT_RECORDER_THRESHOLD", settings.flight_recorder_threshold);
+    settings.exemplars_per_site =
+      get_size_from_environment("CHRONES_EXEMPLARS", settings.exemplars_per_site);
+    settings.exemplars_threshold =
+      get_seconds_from_environment("CHRONES_EXEMPLARS_THRESHOLD", settings.exemplars_threshold);
+    settings.log_block_size =
+      get_size_from_environment("CHRONES_LOG_BLOCK_SIZE", settings.log_block_size);
+    // Enabled by default in real runs, but not in tests, where it would make logs non-deterministic
+    settings.telemetry = get_size_from_environment("CHRONES_TELEMETRY", 1) != 0;
+    return settings;
+  }
+
+  // Light stopwatches with an index keep separate statistics for their first 'light_stopwatch_indexes'
+  // distinct indexes, and put all other indexes together in an overflow bucket
+  std::size_t light_stopwatch_indexes;
+
+  // If not zero, the worker thread logs the statistics of light stopwatches at this interval, and resets them.
+  // This way, long running programs log their light stopwatches before they exit, by time window.
+  std::chrono::nanoseconds summary_interval;
+
+  // Difference between a reference clock and this host's clock, e.g. measured by the job launcher
+  // on each node of a cluster. Logged once, and added by reports to the timestamps of this process.
+  std::chrono::nanoseconds clock_offset;
+
+  // If not zero, enable the flight recorder: events of heavy stopwatches are not logged as they happen.
+  // Each thread keeps its last 'flight_recorder_events' events in memory instead, and they are logged
+  // only when the flight recorder is dumped: on demand, or when a stopwatch lasts longer than
+  // 'flight_recorder_threshold' (if not zero).
+  std::size_t flight_recorder_events;
+  std::chrono::nanoseconds flight_recorder_threshold;
+
+  // If not zero, light stopwatches log up to 'exemplars_per_site' of their slow executions each, with their
+  // timestamps (see 'StopwatchExemplarEvent'). Executions are slow if they last longer than 'exemplars_threshold',
+  // or if it's zero, than the running 99th percentile of the stopwatch.
+  std::size_t exemplars_per_site;
+  std::chrono::nanoseconds exemplars_threshold;
+
+  // If not zero, log in the block format (see 'BlockLogWriter') instead of CSV, in blocks of about this many bytes
+  std::size_t log_block_size;
+
+  // Log the coordinator's own metrics (see 'Telemetry') when it's destroyed, and with periodic summaries
+  bool telemetry;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Core: events and coordinator
 ////////////////////////////////////////////////////////////////////////////////
@@ -143,20 +522,94 @@ class Event {
   virtual ~Event() {}
 
  public:
-  friend std::ostream& operator<<(std::ostream&, const Event&);
-  virtual void output_attributes(std::ostream&) const = 0;
+  friend CsvFormatter& operator<<(CsvFormatter&, const Event&);
+  friend class BlockLogWriter;
+  virtual void output_attributes(CsvFormatter&) const = 0;
 
  private:
   std::size_t thread_id;
   int64_t time;
 };
 
-inline std::ostream& operator<<(std::ostream& oss, const Event& event) {
+inline CsvFormatter& operator<<(CsvFormatter& oss, const Event& event) {
   oss << event.thread_id << ',' << event.time;
   event.output_attributes(oss);
   return oss;
 }
 
+class ClockOffsetEvent : public Event {
+ public:
+  ClockOffsetEvent(
+    const std::size_t thread_id_,
+    const int64_t time_,
+    const int64_t offset_) :
+      Event(thread_id_, time_),
+      offset(offset_) {}
+
+ private:
+  void output_attributes(CsvFormatter& oss) const override {
+    oss << ",clock_offset," << offset;
+  }
+
+ private:
+  int64_t offset;
+};
+
+// What the coordinator costs. All counts and durations since its creation.
+struct Telemetry {
+  uint64_t events;  // Logged, or to be logged
+  uint64_t bytes;  // Written to the stream
+  uint64_t flushes;
+  int64_t flushes_duration;
+  uint64_t peak_backlog;  // Largest number of events waiting for a flush
+  uint64_t contentions;  // Number of times a thread had to wait to add an event
+  int64_t contentions_duration;
+  uint64_t overwritten;  // Events dropped by the flight recorder
+  int64_t worker_cpu_time;
+};
+
+class TelemetryEvent : public Event {
+ public:
+  TelemetryEvent(
+    const std::size_t thread_id_,
+    const int64_t time_,
+    const Telemetry& telemetry_) :
+      Event(thread_id_, time_),
+      telemetry(telemetry_) {}
+
+ private:
+  void output_attributes(CsvFormatter& oss) const override {
+    oss << ",telemetry,"
+      << telemetry.events << ',' << telemetry.bytes << ','
+      << telemetry.flushes << ',' << telemetry.flushes_duration << ','
+      << telemetry.peak_backlog << ','
+      << telemetry.contentions << ',' << telemetry.contentions_duration << ','
+      << telemetry.overwritten << ','
+      << telemetry.worker_cpu_time;
+  }
+
+ private:
+  Telemetry telemetry;
+};
+
+class OsThreadEvent : public Event {
+ public:
+  OsThreadEvent(
+    const std::size_t thread_id_,
+    const int64_t time_,
+    const int64_t os_thread_id_) :
+      Event(thread_id_, time_),
+      os_thread_id(os_thread_id_) {}
+
+ private:
+  void output_attributes(CsvFormatter& oss) const override {
+    oss << ",os_thread," << os_thread_id;
+  }
+
+ private:
+  int64_t os_thread_id;
+};
+
 class StopwatchStartPlainEvent : public Event {
  public:
   StopwatchStartPlainEvent(
@@ -172,8 +625,8 @@ class StopwatchStartPlainEvent : public Event {
   StopwatchStartPlainEvent& operator=(StopwatchStartPlainEvent&&) = default;
 
  private:
-  void output_attributes(std::ostream& oss) const override {
-    oss << ",sw_start," << quote_for_csv(function) << ",-,-";
+  void output_attributes(CsvFormatter& oss) const override {
+    oss << ",sw_start," << csv_quoted(function) << ",-,-";
   }
 
  private:
@@ -197,8 +650,8 @@ class StopwatchStartLabelledEvent : public Event {
   StopwatchStartLabelledEvent& operator=(StopwatchStartLabelledEvent&&) = default;
 
  private:
-  void output_attributes(std::ostream& oss) const override {
-    oss << ",sw_start," << quote_for_csv(function) << ',' << quote_for_csv(label) << ",-";
+  void output_attributes(CsvFormatter& oss) const override {
+    oss << ",sw_start," << csv_quoted(function) << ',' << csv_quoted(label) << ",-";
   }
 
  private:
@@ -225,8 +678,8 @@ class StopwatchStartFullEvent : public Event {
   StopwatchStartFullEvent& operator=(StopwatchStartFullEvent&&) = default;
 
  private:
-  void output_attributes(std::ostream& oss) const override {
-    oss << ",sw_start," << quote_for_csv(function) << ',' << quote_for_csv(label) << ',' << index;
+  void output_attributes(CsvFormatter& oss) const override {
+    oss << ",sw_start," << csv_quoted(function) << ',' << csv_quoted(label) << ',' << index;
   }
 
  private:
@@ -240,12 +693,89 @@ class StopwatchStopEvent : public Event {
   StopwatchStopEvent(
     const std::size_t thread_id_,
     const int64_t time_) :
-      Event(thread_id_, time_) {}
+      StopwatchStopEvent(thread_id_, time_, NAN) {}
+
+  // 'work_' is the amount of work done by the stopwatch (see 'heavy_stopwatch_tmpl::set_work'), NaN if unknown
+  StopwatchStopEvent(
+    const std::size_t thread_id_,
+    const int64_t time_,
+    const double work_) :
+      Event(thread_id_, time_),
+      work(work_) {}
 
  private:
-  void output_attributes(std::ostream& oss) const override {
+  void output_attributes(CsvFormatter& oss) const override {
     oss << ",sw_stop";
+    if (!std::isnan(work)) {
+      oss << ',' << format_number(work);
+    }
+  }
+
+ private:
+  double work;
+};
+
+// A slow execution of a light stopwatch, logged when it stops, for reports to show it in context
+class StopwatchExemplarEvent : public Event {
+ public:
+  StopwatchExemplarEvent(
+    const std::size_t thread_id_,
+    const int64_t time_,
+    const char* function_,
+    const char* label_,
+    const std::string& index_,
+    const int64_t duration_) :
+      Event(thread_id_, time_),
+      function(function_),
+      label(label_),
+      index(index_),
+      duration(duration_) {}
+
+  StopwatchExemplarEvent(const StopwatchExemplarEvent&) = default;
+  StopwatchExemplarEvent(StopwatchExemplarEvent&&) = default;
+  StopwatchExemplarEvent& operator=(const StopwatchExemplarEvent&) = default;
+  StopwatchExemplarEvent& operator=(StopwatchExemplarEvent&&) = default;
+
+ private:
+  void output_attributes(CsvFormatter& oss) const override {
+    oss << ",sw_exemplar," << csv_quoted(function) << ',' << csv_quoted(label)
+      << ',' << index << ',' << duration;
+  }
+
+ private:
+  const char* function;
+  const char* label;
+  // "-" for light stopwatches without an index
+  std::string index;
+  int64_t duration;
+};
+
+// For automatic instrumentation (see 'chrones-functions.cpp' and 'chrones-ompt.cpp'): the function is identified
+// by an address in its code, to be resolved by reports. Paired with a 'StopwatchStopEvent'.
+class FunctionStartEvent : public Event {
+ public:
+  FunctionStartEvent(
+    const std::size_t thread_id_,
+    const int64_t time_,
+    const void* address_,
+    const char* label_) :
+      Event(thread_id_, time_),
+      address(address_),
+      label(label_) {}
+
+  FunctionStartEvent(const FunctionStartEvent&) = default;
+  FunctionStartEvent(FunctionStartEvent&&) = default;
+  FunctionStartEvent& operator=(const FunctionStartEvent&) = default;
+  FunctionStartEvent& operator=(FunctionStartEvent&&) = default;
+
+ private:
+  void output_attributes(CsvFormatter& oss) const override {
+    oss << ",fn_start," << address << ',' << csv_quoted(label) << ",-";
   }
+
+ private:
+  const void* address;
+  const char* label;
 };
 
 class StopwatchSummaryEvent : public Event {
@@ -255,23 +785,27 @@ class StopwatchSummaryEvent : public Event {
     const int64_t time_,
     const char* function_,
     const char* label_,
-    const uint64_t count_,
-    const float mean_,
-    const float standard_deviation_,
-    const float min_,
-    const float median_,
-    const float max_,
-    const float sum_) :
+    const StreamStatistics& stat,
+    const std::string& index_) :
       Event(thread_id_, time_),
       function(function_),
       label(label_),
-      count(count_),
-      mean(mean_),
-      standard_deviation(standard_deviation_),
-      min(min_),
-      median(median_),
-      max(max_),  // NOLINT(build/include_what_you_use)
-      sum(sum_) {}
+      count(stat.count()),
+      mean(stat.mean()),
+      standard_deviation(stat.standard_deviation()),
+      min(stat.min()),
+      median(stat.median()),
+      max(stat.max()),  // NOLINT(build/include_what_you_use)
+      sum(stat.sum()),
+      self_sum(stat.self_sum()),
+      index(index_),
+      percentile_99(stat.quantile(0.99)),
+      work_count(stat.work_count()),
+      work_sum(stat.work_sum()),
+      throughput_mean(stat.throughput_mean()),
+      throughput_min(stat.throughput_quantile(0)),
+      throughput_median(stat.throughput_quantile(0.5)),
+      throughput_percentile_1(stat.throughput_quantile(0.01)) {}
 
   StopwatchSummaryEvent(const StopwatchSummaryEvent&) = default;
   StopwatchSummaryEvent(StopwatchSummaryEvent&&) = default;
@@ -279,17 +813,33 @@ class StopwatchSummaryEvent : public Event {
   StopwatchSummaryEvent& operator=(StopwatchSummaryEvent&&) = default;
 
  private:
-  void output_attributes(std::ostream& oss) const override {
+  virtual void output_name(CsvFormatter& oss) const {
+    oss << ",sw_summary," << csv_quoted(function) << ',' << csv_quoted(label);
+  }
+
+ private:
+  void output_attributes(CsvFormatter& oss) const override {
+    output_name(oss);
     oss
-      << ",sw_summary," << quote_for_csv(function)
-      << ',' << (label == nullptr ? "-" : quote_for_csv(label))
       << ',' << count
       << ',' << static_cast<int64_t>(mean)
       << ',' << static_cast<int64_t>(standard_deviation)
       << ',' << static_cast<int64_t>(min)
       << ',' << static_cast<int64_t>(median)
       << ',' << static_cast<int64_t>(max)
-      << ',' << static_cast<int64_t>(sum);
+      << ',' << static_cast<int64_t>(sum)
+      << ',' << static_cast<int64_t>(self_sum)
+      << ',' << index
+      << ',' << static_cast<int64_t>(percentile_99);
+    if (work_count != 0) {
+      oss
+        << ',' << work_count
+        << ',' << format_number(work_sum)
+        << ',' << format_number(throughput_mean)
+        << ',' << format_number(throughput_min)
+        << ',' << format_number(throughput_median)
+        << ',' << format_number(throughput_percentile_1);
+    }
   }
 
  private:
@@ -302,57 +852,325 @@ class StopwatchSummaryEvent : public Event {
   float median;
   float max;
   float sum;
+  float self_sum;
+  // "-" for all executions, the index for executions with this index, "+" for the overflow bucket
+  std::string index;
+  float percentile_99;
+  // Of the executions with a known amount of work, throughputs in work per second
+  uint64_t work_count;
+  double work_sum;
+  float throughput_mean;
+  float throughput_min;
+  float throughput_median;
+  float throughput_percentile_1;
 };
 
-template<typename Info>
-class coordinator_tmpl {
+// Summary of a function identified by an address in its code, like 'FunctionStartEvent'
+class FunctionSummaryEvent : public StopwatchSummaryEvent {
  public:
-  explicit coordinator_tmpl(std::ostream& stream) :
-    _stream(stream),
-    _events(),
-    _events_mutex(),
-    _statistics(),
-    _statistics_mutex(),
-    _work_done(false),
-    _worker(&coordinator_tmpl<Info>::work, this) {}
+  FunctionSummaryEvent(
+    const std::size_t thread_id_,
+    const int64_t time_,
+    const void* address_,
+    const char* label_,
+    const StreamStatistics& stat) :
+      StopwatchSummaryEvent(thread_id_, time_, nullptr, nullptr, stat, "-"),
+      address(address_),
+      label(label_) {}
 
-  ~coordinator_tmpl() {
-    _work_done = true;
-    _worker.join();
-    add_summary_events();
-    flush_events();
+  FunctionSummaryEvent(const FunctionSummaryEvent&) = default;
+  FunctionSummaryEvent(FunctionSummaryEvent&&) = default;
+  FunctionSummaryEvent& operator=(const FunctionSummaryEvent&) = default;
+  FunctionSummaryEvent& operator=(FunctionSummaryEvent&&) = default;
+
+ private:
+  void output_name(CsvFormatter& oss) const override {
+    oss << ",fn_summary," << address << ',' << csv_quoted(label);
   }
 
+ private:
+  const void* address;
+  const char* label;
+};
+
+// Summary of the acquisitions of a lock (see 'mutex_tmpl'), in one mode ("exclusive" or "shared")
+class LockSummaryEvent : public Event {
  public:
-  void start_heavy_stopwatch(
-    const char* function
-  ) {
-    const int64_t start_time = Info::get_time();
-    add_event(std::move(make_unique<StopwatchStartPlainEvent>(
-      Info::get_thread_id(),
-      start_time,
-      function)));
-  }
+  // 'wait' is only updated by contended acquisitions: the others don't wait
+  LockSummaryEvent(
+    const std::size_t thread_id_,
+    const int64_t time_,
+    const char* name_,
+    const char* mode_,
+    const StreamStatistics& wait,
+    const StreamStatistics& hold) :
+      Event(thread_id_, time_),
+      name(name_),
+      mode(mode_),
+      count(hold.count()),
+      contended_count(wait.count()),
+      wait_sum(wait.count() == 0 ? 0 : wait.sum()),
+      wait_max(wait.count() == 0 ? 0 : wait.max()),
+      hold_sum(hold.sum()),
+      hold_max(hold.max()),
+      hold_percentile_99(hold.quantile(0.99)) {}
+
+  LockSummaryEvent(const LockSummaryEvent&) = default;
+  LockSummaryEvent(LockSummaryEvent&&) = default;
+  LockSummaryEvent& operator=(const LockSummaryEvent&) = default;
+  LockSummaryEvent& operator=(LockSummaryEvent&&) = default;
 
-  void start_heavy_stopwatch(
-    const char* function,
-    const char* label
-  ) {
-    const int64_t start_time = Info::get_time();
-    add_event(std::move(make_unique<StopwatchStartLabelledEvent>(
-      Info::get_thread_id(),
-      start_time,
-      function,
-      label)));
+ private:
+  void output_attributes(CsvFormatter& oss) const override {
+    oss
+      << ",lock_summary," << csv_quoted(name) << ',' << mode
+      << ',' << count
+      << ',' << contended_count
+      << ',' << static_cast<int64_t>(wait_sum)
+      << ',' << static_cast<int64_t>(wait_max)
+      << ',' << static_cast<int64_t>(hold_sum)
+      << ',' << static_cast<int64_t>(hold_max)
+      << ',' << static_cast<int64_t>(hold_percentile_99);
   }
 
-  void start_heavy_stopwatch(
+ private:
+  const char* name;
+  const char* mode;
+  uint64_t count;
+  uint64_t contended_count;
+  float wait_sum;
+  float wait_max;
+  float hold_sum;
+  float hold_max;
+  float hold_percentile_99;
+};
+
+// Compact alternative to the CSV log format.
+// Events are written in blocks, compressed with zlib if Chrones is built with 'CHRONES_USE_ZLIB' (and linked with '-lz').
+// Each block starts with a fixed-size header, so that readers can skip blocks without decompressing them:
+// "CHRB", codec (uint8: 0 for none, 1 for zlib), stored size, raw size, events count (uint32), process id (int32),
+// min and max times (int64), all little-endian.
+// Then each event in the raw block is:
+// - the thread's slot (varint): its rank of first appearance in the block, followed by its id (varint) if it's new
+// - the time (zigzag varint), relative to the previous event of the same thread in the block
+// - the attributes (varint size and bytes), i.e. the end of the event's CSV line, starting with a comma
+class BlockLogWriter {
+ public:
+  BlockLogWriter(std::ostream& stream, const std::size_t block_size) :
+    _stream(stream),
+    _block_size(block_size),
+    _payload(),
+    _threads(),
+    _attributes(),
+    _process_id(0),
+    _events_count(0),
+    _min_time(0),
+    _max_time(0)
+  {}
+
+  BlockLogWriter(const BlockLogWriter&) = delete;
+  BlockLogWriter& operator=(const BlockLogWriter&) = delete;
+
+ public:
+  void write(const int process_id, const Event& event) {
+    if (_events_count != 0 && process_id != _process_id) {
+      flush();
+    }
+    if (_events_count == 0) {
+      _process_id = process_id;
+      _min_time = event.time;
+      _max_time = event.time;
+    }
+
+    auto thread = _threads.find(event.thread_id);
+    if (thread == _threads.end()) {
+      const std::size_t slot = _threads.size();
+      put_varint(slot);
+      put_varint(event.thread_id);
+      thread = _threads.insert(std::make_pair(event.thread_id, ThreadState{slot, 0})).first;
+    } else {
+      put_varint(thread->second.slot);
+    }
+    const int64_t delta = event.time - thread->second.last_time;
+    put_varint((static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));  // Zigzag
+    thread->second.last_time = event.time;
+
+    _attributes.clear();
+    event.output_attributes(_attributes);
+    put_varint(_attributes.size());
+    _payload.append(_attributes.data(), _attributes.size());
+
+    _min_time = std::min(_min_time, event.time);
+    _max_time = std::max(_max_time, event.time);
+    ++_events_count;
+
+    if (_payload.size() >= _block_size) {
+      flush();
+    }
+  }
+
+  // Write the current block, even if it's not full
+  void flush() {
+    if (_events_count == 0) {
+      return;
+    }
+
+    uint8_t codec = 0;
+    std::string stored;
+    #ifdef CHRONES_USE_ZLIB
+    uLongf stored_size = compressBound(_payload.size());
+    stored.resize(stored_size);
+    if (compress2(
+      reinterpret_cast<Bytef*>(&stored[0]), &stored_size,
+      reinterpret_cast<const Bytef*>(_payload.data()), _payload.size(),
+      Z_BEST_SPEED) == Z_OK
+    ) {
+      stored.resize(stored_size);
+      codec = 1;
+    } else {
+      stored = _payload;
+    }
+    #else
+    stored = _payload;
+    #endif
+
+    std::string header("CHRB");
+    header.push_back(static_cast<char>(codec));
+    put_fixed(&header, stored.size(), 4);
+    put_fixed(&header, _payload.size(), 4);
+    put_fixed(&header, _events_count, 4);
+    put_fixed(&header, static_cast<uint32_t>(_process_id), 4);
+    put_fixed(&header, static_cast<uint64_t>(_min_time), 8);
+    put_fixed(&header, static_cast<uint64_t>(_max_time), 8);
+    _stream.write(header.data(), header.size());
+    _stream.write(stored.data(), stored.size());
+
+    discard();
+  }
+
+  // Forget the current block
+  void discard() {
+    _payload.clear();
+    _threads.clear();
+    _events_count = 0;
+  }
+
+ private:
+  void put_varint(uint64_t value) {
+    while (value >= 0x80) {
+      _payload.push_back(static_cast<char>((value & 0x7F) | 0x80));
+      value >>= 7;
+    }
+    _payload.push_back(static_cast<char>(value));
+  }
+
+  static void put_fixed(std::string* out, const uint64_t value, const int bytes) {
+    for (int i = 0; i != bytes; ++i) {
+      out->push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+  }
+
+ private:
+  struct ThreadState {
+    std::size_t slot;
+    int64_t last_time;
+  };
+
+  std::ostream& _stream;
+  const std::size_t _block_size;
+  std::string _payload;
+  std::map<std::size_t, ThreadState> _threads;
+  CsvFormatter _attributes;
+  int _process_id;
+  uint32_t _events_count;
+  int64_t _min_time;
+  int64_t _max_time;
+};
+
+template<typename Info>
+class coordinator_tmpl {
+ public:
+  explicit coordinator_tmpl(std::ostream& stream, const CoordinatorSettings& settings = CoordinatorSettings()) :
+    _settings(settings),
+    _stream(stream),
+    _stream_mutex(),
+    _block_writer(settings.log_block_size == 0 ? nullptr : new BlockLogWriter(stream, settings.log_block_size)),
+    _csv_formatter(),
+    _events(),
+    _events_mutex(),
+    _statistics(),
+    _indexed_statistics(),
+    _function_statistics(),
+    _lock_statistics(),
+    _exemplar_sites(),
+    _statistics_mutex(),
+    _rings(),
+    _rings_mutex(),
+    _free_rings(std::make_shared<FreeRings>()),
+    _flight_recorder_dump_requested(false),
+    _telemetry(),
+    _worker_cpu_time(0),
+    _id(make_id()),
+    _work_done(false),
+    _worker(&coordinator_tmpl<Info>::work, this) {
+    add_clock_offset_event();
+  }
+
+  ~coordinator_tmpl() {
+    _work_done = true;
+    _worker.join();
+    if (_flight_recorder_dump_requested) {
+      dump_flight_recorder();
+    }
+    close_flight_recorder();
+    add_summary_events();
+    if (_settings.telemetry) {
+      // Flush first, so that telemetry accounts for (almost) all events
+      flush_events();
+      add_telemetry_event();
+    }
+    flush_events();
+    if (_block_writer) {
+      _block_writer->flush();
+    }
+  }
+
+ public:
+  void start_heavy_stopwatch(
+    const char* function
+  ) {
+    const int64_t start_time = Info::get_time();
+    announce_thread(start_time);
+    ++heavy_stopwatches_depth().running;
+    add_heavy_event(true, start_time, std::move(make_unique<StopwatchStartPlainEvent>(
+      Info::get_thread_id(),
+      start_time,
+      function)));
+  }
+
+  void start_heavy_stopwatch(
+    const char* function,
+    const char* label
+  ) {
+    const int64_t start_time = Info::get_time();
+    announce_thread(start_time);
+    ++heavy_stopwatches_depth().running;
+    add_heavy_event(true, start_time, std::move(make_unique<StopwatchStartLabelledEvent>(
+      Info::get_thread_id(),
+      start_time,
+      function,
+      label)));
+  }
+
+  void start_heavy_stopwatch(
     const char* function,
     const char* label,
     const int index
   ) {
     const int64_t start_time = Info::get_time();
-    add_event(std::move(make_unique<StopwatchStartFullEvent>(
+    announce_thread(start_time);
+    ++heavy_stopwatches_depth().running;
+    add_heavy_event(true, start_time, std::move(make_unique<StopwatchStartFullEvent>(
       Info::get_thread_id(),
       start_time,
       function,
@@ -360,81 +1178,689 @@ class coordinator_tmpl {
       index)));
   }
 
+  void start_function_heavy_stopwatch(
+    const void* address
+  ) {
+    start_function_heavy_stopwatch(address, nullptr);
+  }
+
+  void start_function_heavy_stopwatch(
+    const void* address,
+    const char* label
+  ) {
+    const int64_t start_time = Info::get_time();
+    announce_thread(start_time);
+    ++heavy_stopwatches_depth().running;
+    add_heavy_event(true, start_time, std::move(make_unique<FunctionStartEvent>(
+      Info::get_thread_id(),
+      start_time,
+      address,
+      label)));
+  }
+
   void stop_heavy_stopwatch() {
+    stop_heavy_stopwatch(NAN);
+  }
+
+  // 'work' is the amount of work done by the stopwatch, NaN if unknown
+  void stop_heavy_stopwatch(const double work) {
     const int64_t stop_time = Info::get_time();
-    add_event(std::move(make_unique<StopwatchStopEvent>(
+    HeavyStopwatchesDepth& depth = heavy_stopwatches_depth();
+    if (depth.running == depth.started_before_fork && depth.started_before_fork != 0) {
+      // The start event is in the parent's log
+      --depth.running;
+      --depth.started_before_fork;
+      return;
+    }
+    --depth.running;
+    add_heavy_event(false, stop_time, std::move(make_unique<StopwatchStopEvent>(
       Info::get_thread_id(),
-      stop_time)));
+      stop_time,
+      work)));
+  }
+
+  // 'fork' duplicates only the calling thread. 'prepare_fork' makes sure no other thread
+  // is in the middle of logging, and one of the 'after_fork_*' functions must be called after 'fork'.
+  void prepare_fork() {
+    _stream_mutex.lock();
+    _rings_mutex.lock();
+    for (auto& ring : _rings) {
+      ring->mutex.lock();
+    }
+    _events_mutex.lock();
+    _statistics_mutex.lock();
+    // Don't let the child inherit (and write again) buffered data
+    _stream.flush();
+  }
+
+  void after_fork_in_parent() {
+    _statistics_mutex.unlock();
+    _events_mutex.unlock();
+    for (auto& ring : _rings) {
+      ring->mutex.unlock();
+    }
+    _rings_mutex.unlock();
+    _stream_mutex.unlock();
+  }
+
+  // The caller must have replaced the content of the stream by then, e.g. reopened it with the child's pid.
+  void after_fork_in_child() {
+    // Buffered events and statistics belong to the parent, which will log them
+    _events.clear();
+    if (_block_writer) {
+      _block_writer->discard();
+    }
+    _statistics.clear();
+    _indexed_statistics.clear();
+    _function_statistics.clear();
+    _lock_statistics.clear();
+    _exemplar_sites.clear();
+    for (auto& ring : _rings) {
+      ring->mutex.unlock();
+    }
+    _rings.clear();
+    // Threads of the parent that hold rings will not give them back to this new list
+    _free_rings = std::make_shared<FreeRings>();
+    _telemetry = Telemetry();
+    _worker_cpu_time = 0;
+    heavy_stopwatches_depth().started_before_fork = heavy_stopwatches_depth().running;
+    // Make 'announce_thread' log the OS thread id again, in the child's log
+    _id = make_id();
+
+    _statistics_mutex.unlock();
+    _events_mutex.unlock();
+    _rings_mutex.unlock();
+    _stream_mutex.unlock();
+
+    // The worker thread doesn't exist in the child: forget it and start a new one
+    _worker.detach();
+    _worker = std::thread(&coordinator_tmpl<Info>::work, this);
+
+    // The child logs into a new file, which reports align on their own
+    add_clock_offset_event();
   }
 
   int64_t start_light_stopwatch() {
+    light_stopwatches_children_durations().push_back(0);
     return Info::get_time();
   }
 
   void stop_light_stopwatch(
     const char* function,
     int64_t start_time
+  ) {
+    stop_light_stopwatch(function, nullptr, start_time, NAN);
+  }
+
+  void stop_light_stopwatch(
+    const char* function,
+    const char* label,
+    int64_t start_time
+  ) {
+    stop_light_stopwatch(function, label, start_time, NAN);
+  }
+
+  // 'work' is the amount of work done by the stopwatch, NaN if unknown
+  void stop_light_stopwatch(
+    const char* function,
+    const char* label,
+    int64_t start_time,
+    const double work
   ) {
     const int64_t stop_time = Info::get_time();
-    accumulate(function, nullptr, stop_time - start_time);
+    const int64_t duration = stop_time - start_time;
+    if (accumulate(function, label, duration, pop_light_stopwatch(duration), work)) {
+      add_exemplar_event(stop_time, function, label, "-", duration);
+    }
+    if (is_over_threshold(duration)) {
+      dump_flight_recorder();
+    }
   }
 
   void stop_light_stopwatch(
     const char* function,
     const char* label,
+    const int index,
+    int64_t start_time
+  ) {
+    stop_light_stopwatch(function, label, index, start_time, NAN);
+  }
+
+  void stop_light_stopwatch(
+    const char* function,
+    const char* label,
+    const int index,
+    int64_t start_time,
+    const double work
+  ) {
+    const int64_t stop_time = Info::get_time();
+    const int64_t duration = stop_time - start_time;
+    if (accumulate(function, label, index, duration, pop_light_stopwatch(duration), work)) {
+      add_exemplar_event(stop_time, function, label, std::to_string(index), duration);
+    }
+    if (is_over_threshold(duration)) {
+      dump_flight_recorder();
+    }
+  }
+
+  void stop_function_light_stopwatch(
+    const void* address,
+    int64_t start_time
+  ) {
+    stop_function_light_stopwatch(address, nullptr, start_time);
+  }
+
+  void stop_function_light_stopwatch(
+    const void* address,
+    const char* label,
     int64_t start_time
   ) {
     const int64_t stop_time = Info::get_time();
-    accumulate(function, label, stop_time - start_time);
+    const int64_t duration = stop_time - start_time;
+    const int64_t self_duration = pop_light_stopwatch(duration);
+    {
+      std::lock_guard<std::mutex> guard(_statistics_mutex);
+      _function_statistics[std::make_tuple(address, label)].update(duration, self_duration);
+    }
+    if (is_over_threshold(duration)) {
+      dump_flight_recorder();
+    }
+  }
+
+  // 'wait' is only meaningful for 'contended' acquisitions, i.e. those that could not acquire the lock immediately
+  void record_lock_acquisition(
+    const char* name,
+    const char* mode,
+    const bool contended,
+    const int64_t wait,
+    const int64_t hold
+  ) {
+    std::lock_guard<std::mutex> guard(_statistics_mutex);
+    LockStatistics& statistics = _lock_statistics[std::make_tuple(name, mode)];
+    if (contended) {
+      statistics.wait.update(wait);
+    }
+    statistics.hold.update(hold);
+  }
+
+  // Log the events kept by the flight recorder, and empty it
+  void dump_flight_recorder() {
+    std::lock_guard<std::mutex> rings_guard(_rings_mutex);
+    for (auto& ring : _rings) {
+      std::lock_guard<std::mutex> guard(ring->mutex);
+      empty_ring(ring.get(), true);
+    }
+  }
+
+  // Async-signal-safe version of 'dump_flight_recorder': the dump is done by the worker thread
+  void request_flight_recorder_dump() {
+    _flight_recorder_dump_requested = true;
   }
 
  private:
+  static uint64_t make_id() {
+    static std::atomic<uint64_t> next_id(1);
+    return next_id++;
+  }
+
+  // Log the OS thread id once per thread, so that reports can link stopwatches
+  // with the per-thread metrics measured by 'chrones run'
+  void announce_thread(const int64_t time) {
+    static thread_local uint64_t announced_to = 0;
+    if (announced_to != _id) {
+      announced_to = _id;
+      add_event(std::move(make_unique<OsThreadEvent>(
+        Info::get_thread_id(),
+        time,
+        Info::get_os_thread_id())));
+    }
+  }
+
+  struct HeavyStopwatchesDepth {
+    int64_t running;
+    // Number of the outermost 'running' stopwatches that were started in the parent process
+    int64_t started_before_fork;
+  };
+
+  static HeavyStopwatchesDepth& heavy_stopwatches_depth() {
+    static thread_local HeavyStopwatchesDepth depth = {0, 0};
+    return depth;
+  }
+
+  // Time spent in nested light stopwatches, for each light stopwatch currently running in this thread
+  static std::vector<int64_t>& light_stopwatches_children_durations() {
+    static thread_local std::vector<int64_t> children_durations;
+    return children_durations;
+  }
+
+  // Return the self duration of the stopping light stopwatch, and count its duration as its parent's children time
+  static int64_t pop_light_stopwatch(const int64_t duration) {
+    std::vector<int64_t>& children_durations = light_stopwatches_children_durations();
+    const int64_t self_duration = duration - children_durations.back();
+    children_durations.pop_back();
+    if (!children_durations.empty()) {
+      children_durations.back() += duration;
+    }
+    return self_duration;
+  }
+
+  // Log and reset the statistics of light stopwatches
   void add_summary_events() {
     const std::size_t thread_id = Info::get_thread_id();
     const int64_t stop_time = Info::get_time();
-    std::lock_guard<std::mutex> guard(_statistics_mutex);
-    for (const auto& stat : _statistics) {
+
+    // Keep the lock short: stopping a light stopwatch must wait for it
+    std::map<std::tuple<const char*, const char*>, StreamStatistics> statistics;
+    std::map<std::tuple<const char*, const char*>, IndexedStatistics> indexed_statistics;
+    std::map<std::tuple<const void*, const char*>, StreamStatistics> function_statistics;
+    std::map<std::tuple<const char*, const char*>, LockStatistics> lock_statistics;
+    {
+      std::lock_guard<std::mutex> guard(_statistics_mutex);
+      std::swap(statistics, _statistics);
+      std::swap(indexed_statistics, _indexed_statistics);
+      std::swap(function_statistics, _function_statistics);
+      std::swap(lock_statistics, _lock_statistics);
+    }
+
+    for (const auto& stat : statistics) {
       const char* function;
       const char* label;
       std::tie(function, label) = stat.first;
-      add_event(std::move(make_unique<StopwatchSummaryEvent>(
-        thread_id,
-        stop_time,
-        function,
-        label,
-        stat.second.count(),
-        stat.second.mean(),
-        stat.second.standard_deviation(),
-        stat.second.min(),
-        stat.second.median(),
-        stat.second.max(),
-        stat.second.sum())));
-    }
-  }
-
-  void accumulate(
+      add_summary_event(thread_id, stop_time, function, label, stat.second, "-");
+
+      const auto indexed = indexed_statistics.find(stat.first);
+      if (indexed != indexed_statistics.end()) {
+        for (const auto& index_stat : indexed->second.indexes) {
+          add_summary_event(thread_id, stop_time, function, label, index_stat.second, std::to_string(index_stat.first));
+        }
+        if (indexed->second.other_indexes.count() != 0) {
+          add_summary_event(thread_id, stop_time, function, label, indexed->second.other_indexes, "+");
+        }
+      }
+    }
+
+    for (const auto& stat : function_statistics) {
+      add_event(std::move(make_unique<FunctionSummaryEvent>(
+        thread_id, stop_time, std::get<0>(stat.first), std::get<1>(stat.first), stat.second)));
+    }
+
+    for (const auto& stat : lock_statistics) {
+      add_event(std::move(make_unique<LockSummaryEvent>(
+        thread_id, stop_time, std::get<0>(stat.first), std::get<1>(stat.first), stat.second.wait, stat.second.hold)));
+    }
+  }
+
+  void add_summary_event(
+      const std::size_t thread_id,
+      const int64_t time,
       const char* function,
       const char* label,
-      const int64_t duration) {
+      const StreamStatistics& stat,
+      const std::string& index) {
+    // Qualified: since C++14, 'std::make_unique' is also found through 'index' (argument-dependent lookup)
+    add_event(std::move(chrones::make_unique<StopwatchSummaryEvent>(
+      thread_id,
+      time,
+      function,
+      label,
+      stat,
+      index)));
+  }
+
+  // Return true if the execution must be logged as an exemplar
+  bool accumulate(
+      const char* function,
+      const char* label,
+      const int64_t duration,
+      const int64_t self_duration,
+      const double work) {
+    const auto key = std::make_tuple(function, label);
     std::lock_guard<std::mutex> guard(_statistics_mutex);
-    _statistics[std::make_tuple(function, label)].update(duration);
+    StreamStatistics& statistics = _statistics[key];
+    statistics.update(duration, self_duration, work);
+    return is_exemplar(key, statistics, duration);
+  }
+
+  bool accumulate(
+      const char* function,
+      const char* label,
+      const int index,
+      const int64_t duration,
+      const int64_t self_duration,
+      const double work) {
+    const auto key = std::make_tuple(function, label);
+    std::lock_guard<std::mutex> guard(_statistics_mutex);
+    StreamStatistics& statistics = _statistics[key];
+    statistics.update(duration, self_duration, work);
+    const bool exemplar = is_exemplar(key, statistics, duration);
+
+    IndexedStatistics& indexed = _indexed_statistics[key];
+    auto index_stat = indexed.indexes.find(index);
+    if (index_stat != indexed.indexes.end()) {
+      index_stat->second.update(duration, self_duration);
+    } else if (indexed.indexes.size() < _settings.light_stopwatch_indexes) {
+      indexed.indexes[index].update(duration, self_duration);
+    } else {
+      indexed.other_indexes.update(duration, self_duration);
+    }
+    return exemplar;
+  }
+
+  // Guarded by '_statistics_mutex'
+  bool is_exemplar(
+      const std::tuple<const char*, const char*>& key,
+      const StreamStatistics& statistics,
+      const int64_t duration) {
+    if (_settings.exemplars_per_site == 0) {
+      return false;
+    }
+    ExemplarSite& site = _exemplar_sites[key];
+    if (site.logged >= _settings.exemplars_per_site) {
+      return false;
+    }
+    float threshold = _settings.exemplars_threshold.count();
+    if (threshold == 0) {
+      // Refresh the running percentile when the number of executions reaches a power of two: 'quantile'
+      // costs linear time, so its amortized cost is constant. Too few executions give no meaningful percentile.
+      const uint64_t count = statistics.count();
+      if (count >= 128 && (count & (count - 1)) == 0) {
+        site.percentile_99 = statistics.quantile(0.99);
+      }
+      threshold = site.percentile_99;
+    }
+    if (duration > threshold) {
+      ++site.logged;
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  void add_clock_offset_event() {
+    if (_settings.clock_offset.count() != 0) {
+      add_event(std::move(make_unique<ClockOffsetEvent>(
+        Info::get_thread_id(),
+        Info::get_time(),
+        _settings.clock_offset.count())));
+    }
+  }
+
+  void add_exemplar_event(
+      const int64_t stop_time,
+      const char* function,
+      const char* label,
+      const std::string& index,
+      const int64_t duration) {
+    announce_thread(stop_time);
+    add_event(std::move(chrones::make_unique<StopwatchExemplarEvent>(
+      Info::get_thread_id(),
+      stop_time,
+      function,
+      label,
+      index,
+      duration)));
   }
 
   void add_event(std::unique_ptr<Event> event) {
-    std::lock_guard<std::mutex> guard(_events_mutex);
+    std::unique_lock<std::mutex> lock(_events_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      // Measure only contended locks: reading the clock for each event would cost too much
+      const auto wait_start = std::chrono::steady_clock::now();
+      lock.lock();
+      ++_telemetry.contentions;
+      _telemetry.contentions_duration += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - wait_start).count();
+    }
     _events.push_back(std::move(event));
+    ++_telemetry.events;
+    _telemetry.peak_backlog = std::max<uint64_t>(_telemetry.peak_backlog, _events.size());
+  }
+
+  void add_telemetry_event() {
+    if (!_settings.telemetry) {
+      return;
+    }
+
+    Telemetry telemetry;
+    {
+      std::lock_guard<std::mutex> stream_guard(_stream_mutex);
+      std::lock_guard<std::mutex> rings_guard(_rings_mutex);
+      uint64_t overwritten = 0;
+      for (auto& ring : _rings) {
+        std::lock_guard<std::mutex> guard(ring->mutex);
+        overwritten += ring->overwritten;
+      }
+      std::lock_guard<std::mutex> events_guard(_events_mutex);
+      telemetry = _telemetry;
+      telemetry.overwritten = overwritten;
+    }
+    telemetry.worker_cpu_time = _worker_cpu_time;
+    add_event(std::move(make_unique<TelemetryEvent>(
+      Info::get_thread_id(),
+      Info::get_time(),
+      telemetry)));
+  }
+
+  struct RecordedEvent {
+    std::unique_ptr<Event> event;
+    bool is_start;
+  };
+
+  // The flight recorder of a thread
+  struct FlightRecorderRing {
+    FlightRecorderRing() :
+      mutex(), events(), oldest(0), consumed_starts(), start_times(), overwritten(0), next_free(nullptr) {}
+    FlightRecorderRing(const FlightRecorderRing&) = delete;
+    FlightRecorderRing& operator=(const FlightRecorderRing&) = delete;
+
+    // Locked by the thread itself, and when dumping
+    std::mutex mutex;
+    // Once full, new events overwrite 'events[oldest]'
+    std::vector<RecordedEvent> events;
+    std::size_t oldest;
+    // For each running stopwatch whose start event has left the ring: was it logged, or overwritten?
+    // Its stop event is logged (even if it's overwritten) only in the first case, so that logs pair them.
+    std::vector<bool> consumed_starts;
+    // Of running stopwatches, to compare their durations with the threshold
+    std::vector<int64_t> start_times;
+    uint64_t overwritten;
+    // Only used while in 'FreeRings'
+    FlightRecorderRing* next_free;
+  };
+
+  // The rings of exited threads, to be reused by new threads. They stay in '_rings' and keep their events,
+  // so that dumps still include the last events of exited threads until they are overwritten.
+  // Lock-free, so that short-lived threads don't contend on '_rings_mutex'.
+  struct FreeRings {
+    FreeRings() : head(nullptr) {}
+
+    void push(FlightRecorderRing* first, FlightRecorderRing* last) {
+      last->next_free = head.load();
+      while (!head.compare_exchange_weak(last->next_free, first)) {}
+    }
+
+    // Taking the whole list avoids the ABA problem of popping a single ring
+    FlightRecorderRing* pop() {
+      FlightRecorderRing* ring = head.exchange(nullptr);
+      if (ring && ring->next_free) {
+        FlightRecorderRing* last = ring->next_free;
+        while (last->next_free) {
+          last = last->next_free;
+        }
+        push(ring->next_free, last);
+      }
+      return ring;
+    }
+
+    std::atomic<FlightRecorderRing*> head;
+  };
+
+  // Gives its ring back to the coordinator when the thread exits
+  struct ThreadRing {
+    ThreadRing() : coordinator_id(0), free_rings(), ring(nullptr) {}
+    ThreadRing(const ThreadRing&) = delete;
+    ThreadRing& operator=(const ThreadRing&) = delete;
+
+    ~ThreadRing() {
+      release();
+    }
+
+    void release() {
+      // Expired if the coordinator was destroyed, or replaced after a fork
+      const std::shared_ptr<FreeRings> rings = free_rings.lock();
+      if (rings && ring) {
+        rings->push(ring, ring);
+      }
+      ring = nullptr;
+    }
+
+    uint64_t coordinator_id;
+    std::weak_ptr<FreeRings> free_rings;
+    FlightRecorderRing* ring;
+  };
+
+  void add_heavy_event(const bool is_start, const int64_t time, std::unique_ptr<Event> event) {
+    if (_settings.flight_recorder_events == 0) {
+      add_event(std::move(event));
+    } else if (record_event(is_start, time, std::move(event))) {
+      dump_flight_recorder();
+    }
+  }
+
+  // Return true if the event stops a stopwatch that lasted longer than the threshold
+  bool record_event(const bool is_start, const int64_t time, std::unique_ptr<Event> event) {
+    FlightRecorderRing* ring = thread_ring();
+    std::lock_guard<std::mutex> guard(ring->mutex);
+
+    if (ring->events.size() < _settings.flight_recorder_events) {
+      ring->events.push_back(RecordedEvent{std::move(event), is_start});
+    } else {
+      RecordedEvent& oldest = ring->events[ring->oldest];
+      if (consume_recorded_event(ring, oldest, false)) {
+        // Stop event of a stopwatch whose start event was dumped
+        add_event(std::move(oldest.event));
+      }
+      oldest.event = std::move(event);
+      oldest.is_start = is_start;
+      ++ring->overwritten;
+      ring->oldest = (ring->oldest + 1) % ring->events.size();
+    }
+
+    if (is_start) {
+      ring->start_times.push_back(time);
+      return false;
+    } else {
+      const int64_t duration = time - ring->start_times.back();
+      ring->start_times.pop_back();
+      return is_over_threshold(duration);
+    }
+  }
+
+  FlightRecorderRing* thread_ring() {
+    static thread_local ThreadRing thread_ring;
+    if (thread_ring.coordinator_id != _id) {
+      thread_ring.release();
+      thread_ring.coordinator_id = _id;
+      thread_ring.free_rings = _free_rings;
+      thread_ring.ring = _free_rings->pop();
+      if (!thread_ring.ring) {
+        std::lock_guard<std::mutex> guard(_rings_mutex);
+        _rings.push_back(std::unique_ptr<FlightRecorderRing>(new FlightRecorderRing));
+        thread_ring.ring = _rings.back().get();
+      }
+    }
+    return thread_ring.ring;
+  }
+
+ public:
+  // Number of flight recorder rings allocated so far: about the largest number of simultaneous threads
+  std::size_t flight_recorder_rings() {
+    std::lock_guard<std::mutex> guard(_rings_mutex);
+    return _rings.size();
+  }
+
+ private:
+
+  bool is_over_threshold(const int64_t duration) const {
+    return _settings.flight_recorder_events != 0
+      && _settings.flight_recorder_threshold.count() != 0
+      && duration >= _settings.flight_recorder_threshold.count();
+  }
+
+  // Return true if the event must be logged when it leaves the ring.
+  // Start events are logged if 'log_start', and stop events if their start event was logged.
+  static bool consume_recorded_event(FlightRecorderRing* ring, const RecordedEvent& recorded, const bool log_start) {
+    if (recorded.is_start) {
+      ring->consumed_starts.push_back(log_start);
+      return log_start;
+    } else {
+      const bool start_logged = ring->consumed_starts.back();
+      ring->consumed_starts.pop_back();
+      return start_logged;
+    }
+  }
+
+  // The caller must hold 'ring->mutex'
+  void empty_ring(FlightRecorderRing* ring, const bool log_starts) {
+    const std::size_t size = ring->events.size();
+    {
+      std::lock_guard<std::mutex> guard(_events_mutex);
+      for (std::size_t i = 0; i != size; ++i) {
+        RecordedEvent& recorded = ring->events[(ring->oldest + i) % size];
+        if (consume_recorded_event(ring, recorded, log_starts)) {
+          _events.push_back(std::move(recorded.event));
+          ++_telemetry.events;
+        }
+      }
+      _telemetry.peak_backlog = std::max<uint64_t>(_telemetry.peak_backlog, _events.size());
+    }
+    ring->events.clear();
+    ring->oldest = 0;
+  }
+
+  // Log the stop events of stopwatches whose start events were dumped
+  void close_flight_recorder() {
+    std::lock_guard<std::mutex> rings_guard(_rings_mutex);
+    for (auto& ring : _rings) {
+      std::lock_guard<std::mutex> guard(ring->mutex);
+      empty_ring(ring.get(), false);
+    }
   }
 
   void work() {
+    auto last_summary_time = std::chrono::steady_clock::now();
+
     // Beware, this loop may not even be run once, if the coordinator is destroyed quickly.
     // This is why we call 'flush_events' in the destructor after joining the '_worker'.
     while (!_work_done) {
+      if (_settings.summary_interval.count() != 0) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_summary_time >= _settings.summary_interval) {
+          add_summary_events();
+          add_telemetry_event();
+          last_summary_time = now;
+        }
+      }
+      if (_flight_recorder_dump_requested.exchange(false)) {
+        dump_flight_recorder();
+      }
       flush_events();
+      _worker_cpu_time = get_thread_cpu_time();
       std::this_thread::sleep_for(std::chrono::milliseconds(100));  // Avoid using 100% CPU
     }
   }
 
+  static int64_t get_thread_cpu_time() {
+    timespec t;
+    if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) != 0) {
+      return 0;
+    }
+    return static_cast<int64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
+  }
+
   void flush_events() {
+    // Keep '_stream_mutex' until events are written, so that they are not lost by a 'fork'
+    std::lock_guard<std::mutex> stream_guard(_stream_mutex);
     std::vector<std::unique_ptr<Event>> events;
     {
       std::lock_guard<std::mutex> guard(_events_mutex);
@@ -445,21 +1871,87 @@ class coordinator_tmpl {
     }
 
     const int process_id = Info::get_process_id();
+    const auto flush_start = std::chrono::steady_clock::now();
+    const std::streampos position_before = _stream.tellp();
 
-    for (auto& event : events) {
-      _stream << process_id << ',' << *event << '\n';  // No std::endl: don't flush each line, improve performance
+    if (_block_writer) {
+      for (auto& event : events) {
+        _block_writer->write(process_id, *event);
+      }
+    } else {
+      for (auto& event : events) {
+        _csv_formatter << process_id << ',' << *event << '\n';
+        // Large writes bypass the stream's own buffer
+        if (_csv_formatter.size() >= (1 << 20)) {
+          _csv_formatter.write_to(_stream);
+        }
+      }
+      _csv_formatter.write_to(_stream);
+    }
+
+    const std::streampos position_after = _stream.tellp();
+    // Guarded by '_stream_mutex'
+    ++_telemetry.flushes;
+    _telemetry.flushes_duration += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - flush_start).count();
+    if (position_before != std::streampos(-1) && position_after != std::streampos(-1)) {
+      _telemetry.bytes += position_after - position_before;
     }
   }
 
  private:
+  struct IndexedStatistics {
+    IndexedStatistics() : indexes(), other_indexes() {}
+
+    std::map<int, StreamStatistics> indexes;
+    StreamStatistics other_indexes;
+  };
+
+  struct LockStatistics {
+    LockStatistics() : wait(), hold() {}
+
+    StreamStatistics wait;
+    StreamStatistics hold;
+  };
+
+  struct ExemplarSite {
+    ExemplarSite() : logged(0), percentile_99(std::numeric_limits<float>::infinity()) {}
+
+    std::size_t logged;
+    float percentile_99;  // Running estimate, see 'is_exemplar'
+  };
+
+  const CoordinatorSettings _settings;
+
   std::ostream& _stream;
+  std::mutex _stream_mutex;
+  std::unique_ptr<BlockLogWriter> _block_writer;  // Guarded by '_stream_mutex'
+  CsvFormatter _csv_formatter;  // Guarded by '_stream_mutex'
 
   std::vector<std::unique_ptr<Event>> _events;
   std::mutex _events_mutex;
 
   std::map<std::tuple<const char*, const char*>, StreamStatistics> _statistics;
+  std::map<std::tuple<const char*, const char*>, IndexedStatistics> _indexed_statistics;
+  std::map<std::tuple<const void*, const char*>, StreamStatistics> _function_statistics;  // By address and label
+  std::map<std::tuple<const char*, const char*>, LockStatistics> _lock_statistics;  // By name and mode
+  // Not reset by summaries: the number of exemplars is limited for the whole run
+  std::map<std::tuple<const char*, const char*>, ExemplarSite> _exemplar_sites;
   std::mutex _statistics_mutex;
 
+  // Lock order: '_stream_mutex', '_rings_mutex', rings' mutexes, '_events_mutex', '_statistics_mutex'
+  std::vector<std::unique_ptr<FlightRecorderRing>> _rings;
+  std::mutex _rings_mutex;
+  // After '_rings', to be destroyed before them: threads exiting later won't give their rings back
+  std::shared_ptr<FreeRings> _free_rings;
+  std::atomic_bool _flight_recorder_dump_requested;
+
+  // 'events', 'peak_backlog' and 'contentions*' are guarded by '_events_mutex', 'bytes' and 'flushes*' by '_stream_mutex'
+  Telemetry _telemetry;
+  std::atomic<int64_t> _worker_cpu_time;
+
+  uint64_t _id;
+
   std::atomic_bool _work_done;
   std::thread _worker;  // Keep _worker last: all other members must be fully constructed before it starts
 };
@@ -474,7 +1966,8 @@ class heavy_stopwatch_tmpl {
   heavy_stopwatch_tmpl(
       coordinator_tmpl<Info>* coordinator,
       const char* function) :
-        _coordinator(coordinator) {
+        _coordinator(coordinator),
+        _work(NAN) {
     if (_coordinator) {
       _coordinator->start_heavy_stopwatch(function);
     }
@@ -484,7 +1977,8 @@ class heavy_stopwatch_tmpl {
       coordinator_tmpl<Info>* coordinator,
       const char* function,
       const char* label) :
-        _coordinator(coordinator) {
+        _coordinator(coordinator),
+        _work(NAN) {
     if (_coordinator) {
       _coordinator->start_heavy_stopwatch(function, label);
     }
@@ -495,7 +1989,8 @@ class heavy_stopwatch_tmpl {
       const char* function,
       const char* label,
       const int index) :
-        _coordinator(coordinator) {
+        _coordinator(coordinator),
+        _work(NAN) {
     if (_coordinator) {
       _coordinator->start_heavy_stopwatch(function, label, index);
     }
@@ -503,7 +1998,7 @@ class heavy_stopwatch_tmpl {
 
   ~heavy_stopwatch_tmpl() {
     if (_coordinator) {
-      _coordinator->stop_heavy_stopwatch();
+      _coordinator->stop_heavy_stopwatch(_work);
     }
   }
 
@@ -512,8 +2007,13 @@ class heavy_stopwatch_tmpl {
   heavy_stopwatch_tmpl& operator=(const heavy_stopwatch_tmpl&) = default;
   heavy_stopwatch_tmpl& operator=(heavy_stopwatch_tmpl&&) = default;
 
+ public:
+  // Amount of work (e.g. bytes or items) done by this stopwatch, to report its throughput. See 'CHRONES_SET_WORK'.
+  void set_work(const double work) { _work = work; }
+
  private:
   coordinator_tmpl<Info>* _coordinator;
+  double _work;
 };
 
 template<typename Info>
@@ -524,23 +2024,35 @@ class plain_light_stopwatch_tmpl {
     const char* function) :
     _coordinator(coordinator),
     _function(function),
+    _work(NAN),
     _start_time(_coordinator ? _coordinator->start_light_stopwatch() : 0)
   {}
 
   ~plain_light_stopwatch_tmpl() {
     if (_coordinator) {
-      _coordinator->stop_light_stopwatch(_function, _start_time);
+      _coordinator->stop_light_stopwatch(_function, nullptr, _start_time, _work);
     }
   }
 
-  plain_light_stopwatch_tmpl(const plain_light_stopwatch_tmpl&) = default;
-  plain_light_stopwatch_tmpl(plain_light_stopwatch_tmpl&&) = default;
-  plain_light_stopwatch_tmpl& operator=(const plain_light_stopwatch_tmpl&) = default;
-  plain_light_stopwatch_tmpl& operator=(plain_light_stopwatch_tmpl&&) = default;
+  // Stopped only once, by the destructor of the moved-to stopwatch
+  plain_light_stopwatch_tmpl(const plain_light_stopwatch_tmpl&) = delete;
+  plain_light_stopwatch_tmpl(plain_light_stopwatch_tmpl&& other) :
+      _coordinator(other._coordinator),
+      _function(other._function),
+      _work(other._work),
+      _start_time(other._start_time) {
+    other._coordinator = nullptr;
+  }
+  plain_light_stopwatch_tmpl& operator=(const plain_light_stopwatch_tmpl&) = delete;
+  plain_light_stopwatch_tmpl& operator=(plain_light_stopwatch_tmpl&&) = delete;
+
+ public:
+  void set_work(const double work) { _work = work; }
 
  private:
   coordinator_tmpl<Info>* _coordinator;
   const char* _function;
+  double _work;
   int64_t _start_time;
 };
 
@@ -554,24 +2066,85 @@ class labelled_light_stopwatch_tmpl {
       _coordinator(coordinator),
       _function(function),
       _label(label),
+      _work(NAN),
       _start_time(_coordinator ? _coordinator->start_light_stopwatch() : 0)
   {}
 
   ~labelled_light_stopwatch_tmpl() {
     if (_coordinator) {
-      _coordinator->stop_light_stopwatch(_function, _label, _start_time);
+      _coordinator->stop_light_stopwatch(_function, _label, _start_time, _work);
+    }
+  }
+
+  // Stopped only once, by the destructor of the moved-to stopwatch
+  labelled_light_stopwatch_tmpl(const labelled_light_stopwatch_tmpl&) = delete;
+  labelled_light_stopwatch_tmpl(labelled_light_stopwatch_tmpl&& other) :
+      _coordinator(other._coordinator),
+      _function(other._function),
+      _label(other._label),
+      _work(other._work),
+      _start_time(other._start_time) {
+    other._coordinator = nullptr;
+  }
+  labelled_light_stopwatch_tmpl& operator=(const labelled_light_stopwatch_tmpl&) = delete;
+  labelled_light_stopwatch_tmpl& operator=(labelled_light_stopwatch_tmpl&&) = delete;
+
+ public:
+  void set_work(const double work) { _work = work; }
+
+ private:
+  coordinator_tmpl<Info>* _coordinator;
+  const char* _function;
+  const char* _label;
+  double _work;
+  int64_t _start_time;
+};
+
+template<typename Info>
+class indexed_light_stopwatch_tmpl {
+ public:
+  indexed_light_stopwatch_tmpl(
+    coordinator_tmpl<Info>* coordinator,
+    const char* function,
+    const char* label,
+    const int index) :
+      _coordinator(coordinator),
+      _function(function),
+      _label(label),
+      _index(index),
+      _work(NAN),
+      _start_time(_coordinator ? _coordinator->start_light_stopwatch() : 0)
+  {}
+
+  ~indexed_light_stopwatch_tmpl() {
+    if (_coordinator) {
+      _coordinator->stop_light_stopwatch(_function, _label, _index, _start_time, _work);
     }
   }
 
-  labelled_light_stopwatch_tmpl(const labelled_light_stopwatch_tmpl&) = default;
-  labelled_light_stopwatch_tmpl(labelled_light_stopwatch_tmpl&&) = default;
-  labelled_light_stopwatch_tmpl& operator=(const labelled_light_stopwatch_tmpl&) = default;
-  labelled_light_stopwatch_tmpl& operator=(labelled_light_stopwatch_tmpl&&) = default;
+  // Stopped only once, by the destructor of the moved-to stopwatch
+  indexed_light_stopwatch_tmpl(const indexed_light_stopwatch_tmpl&) = delete;
+  indexed_light_stopwatch_tmpl(indexed_light_stopwatch_tmpl&& other) :
+      _coordinator(other._coordinator),
+      _function(other._function),
+      _label(other._label),
+      _index(other._index),
+      _work(other._work),
+      _start_time(other._start_time) {
+    other._coordinator = nullptr;
+  }
+  indexed_light_stopwatch_tmpl& operator=(const indexed_light_stopwatch_tmpl&) = delete;
+  indexed_light_stopwatch_tmpl& operator=(indexed_light_stopwatch_tmpl&&) = delete;
+
+ public:
+  void set_work(const double work) { _work = work; }
 
  private:
   coordinator_tmpl<Info>* _coordinator;
   const char* _function;
   const char* _label;
+  int _index;
+  double _work;
   int64_t _start_time;
 };
 
@@ -592,6 +2165,162 @@ labelled_light_stopwatch_tmpl<Info> light_stopwatch_tmpl(
   return labelled_light_stopwatch_tmpl<Info>(coordinator, function, label);
 }
 
+template<typename Info>
+indexed_light_stopwatch_tmpl<Info> light_stopwatch_tmpl(
+  coordinator_tmpl<Info>* coordinator,
+  const char* function,
+  const char* label,
+  const int index
+) {
+  return indexed_light_stopwatch_tmpl<Info>(coordinator, function, label, index);
+}
+
+// Drop-in replacement for a lockable type (e.g. 'std::mutex'), usable with 'std::lock_guard', that records
+// for each acquisition the time spent waiting for the lock (if it's contended) and the time it's held.
+template<typename Info, typename Lockable>
+class mutex_tmpl {
+ public:
+  mutex_tmpl(
+    coordinator_tmpl<Info>* coordinator,
+    const char* name) :
+      _coordinator(coordinator),
+      _name(name),
+      _lockable(),
+      _contended(false),
+      _wait(0),
+      _acquired_at(0)
+  {}
+
+  mutex_tmpl(const mutex_tmpl&) = delete;
+  mutex_tmpl& operator=(const mutex_tmpl&) = delete;
+
+ public:
+  void lock() {
+    if (!_coordinator) {
+      _lockable.lock();
+    } else if (_lockable.try_lock()) {
+      // Don't read the clock twice when the lock is free
+      _contended = false;
+      _acquired_at = Info::get_time();
+    } else {
+      const int64_t wait_start = Info::get_time();
+      _lockable.lock();
+      _contended = true;
+      _acquired_at = Info::get_time();
+      _wait = _acquired_at - wait_start;
+    }
+  }
+
+  bool try_lock() {
+    if (!_lockable.try_lock()) {
+      return false;
+    }
+    if (_coordinator) {
+      _contended = false;
+      _acquired_at = Info::get_time();
+    }
+    return true;
+  }
+
+  void unlock() {
+    if (!_coordinator) {
+      _lockable.unlock();
+      return;
+    }
+    // Copy before releasing: the next owner will overwrite them
+    const bool contended = _contended;
+    const int64_t wait = _wait;
+    const int64_t hold = Info::get_time() - _acquired_at;
+    _lockable.unlock();
+    _coordinator->record_lock_acquisition(_name, "exclusive", contended, wait, hold);
+  }
+
+ protected:
+  Lockable& lockable() { return _lockable; }
+
+  coordinator_tmpl<Info>* coordinator() const { return _coordinator; }
+
+  const char* name() const { return _name; }
+
+ private:
+  coordinator_tmpl<Info>* _coordinator;
+  const char* _name;
+  Lockable _lockable;
+  // Of the current acquisition, guarded by the lock itself
+  bool _contended;
+  int64_t _wait;
+  int64_t _acquired_at;
+};
+
+// Like 'mutex_tmpl', with shared acquisitions recorded separately
+template<typename Info>
+class shared_mutex_tmpl : public mutex_tmpl<Info, rwlock> {
+ public:
+  shared_mutex_tmpl(
+    coordinator_tmpl<Info>* coordinator,
+    const char* name) :
+      mutex_tmpl<Info, rwlock>(coordinator, name)
+  {}
+
+ public:
+  void lock_shared() {
+    if (!this->coordinator()) {
+      this->lockable().lock_shared();
+    } else if (this->lockable().try_lock_shared()) {
+      shared_acquisitions().push_back(SharedAcquisition{this, false, 0, Info::get_time()});
+    } else {
+      const int64_t wait_start = Info::get_time();
+      this->lockable().lock_shared();
+      const int64_t acquired_at = Info::get_time();
+      shared_acquisitions().push_back(SharedAcquisition{this, true, acquired_at - wait_start, acquired_at});
+    }
+  }
+
+  bool try_lock_shared() {
+    if (!this->lockable().try_lock_shared()) {
+      return false;
+    }
+    if (this->coordinator()) {
+      shared_acquisitions().push_back(SharedAcquisition{this, false, 0, Info::get_time()});
+    }
+    return true;
+  }
+
+  void unlock_shared() {
+    if (!this->coordinator()) {
+      this->lockable().unlock_shared();
+      return;
+    }
+    const int64_t released_at = Info::get_time();
+    this->lockable().unlock_shared();
+
+    // Several threads can share the lock: each one remembers its own acquisitions
+    std::vector<SharedAcquisition>& acquisitions = shared_acquisitions();
+    for (auto acquisition = acquisitions.rbegin(); acquisition != acquisitions.rend(); ++acquisition) {
+      if (acquisition->lock == this) {
+        const SharedAcquisition released = *acquisition;
+        acquisitions.erase(std::next(acquisition).base());
+        this->coordinator()->record_lock_acquisition(
+          this->name(), "shared", released.contended, released.wait, released_at - released.acquired_at);
+        break;
+      }
+    }
+  }
+
+ private:
+  struct SharedAcquisition {
+    const void* lock;
+    bool contended;
+    int64_t wait;
+    int64_t acquired_at;
+  };
+
+  static std::vector<SharedAcquisition>& shared_acquisitions() {
+    static thread_local std::vector<SharedAcquisition> acquisitions;
+    return acquisitions;
+  }
+};
+
 struct RealInfo {
   static int64_t get_time() {
     const auto now = std::chrono::system_clock::now();
@@ -605,6 +2334,11 @@ struct RealInfo {
   static std::size_t get_thread_id() {
     return std::hash<std::thread::id>()(std::this_thread::get_id());
   }
+
+  static int64_t get_os_thread_id() {
+    // Not cached: it changes on 'fork', and we only need it once per thread
+    return ::syscall(SYS_gettid);
+  }
 };
 
 typedef heavy_stopwatch_tmpl<RealInfo> heavy_stopwatch;
@@ -624,19 +2358,104 @@ inline labelled_light_stopwatch_tmpl<RealInfo> light_stopwatch(
   return labelled_light_stopwatch_tmpl<RealInfo>(coordinator, function, label);
 }
 
-inline labelled_light_stopwatch_tmpl<RealInfo> light_stopwatch(
+inline indexed_light_stopwatch_tmpl<RealInfo> light_stopwatch(
   coordinator_tmpl<RealInfo>* coordinator,
   const char* function,
   const char* label,
-  int
+  const int index
 ) {
-  return labelled_light_stopwatch_tmpl<RealInfo>(coordinator, function, label);
+  return indexed_light_stopwatch_tmpl<RealInfo>(coordinator, function, label, index);
 }
 
 typedef coordinator_tmpl<RealInfo> coordinator;
 
 extern std::unique_ptr<coordinator> global_coordinator;
 
+// Mutexes report to the global coordinator if it exists when they are constructed:
+// globals defined in other translation units than the one using 'CHRONABLE' may be constructed before it.
+class mutex : public mutex_tmpl<RealInfo, std::mutex> {
+ public:
+  explicit mutex(const char* name) : mutex_tmpl<RealInfo, std::mutex>(global_coordinator.get(), name) {}
+};
+
+class shared_mutex : public shared_mutex_tmpl<RealInfo> {
+ public:
+  explicit shared_mutex(const char* name) : shared_mutex_tmpl<RealInfo>(global_coordinator.get(), name) {}
+};
+
+inline std::ofstream& global_stream() {
+  static std::ofstream stream;
+  return stream;
+}
+
+inline std::string& global_log_file_name_prefix() {
+  static std::string prefix;
+  return prefix;
+}
+
+inline std::string& global_log_file_name_suffix() {
+  static std::string suffix;
+  return suffix;
+}
+
+inline void open_global_stream() {
+  global_stream().open(
+    global_log_file_name_prefix() + std::to_string(::getpid()) + global_log_file_name_suffix(),
+    std::ios_base::app | std::ios_base::binary);
+}
+
+// Reports need the memory mappings of the process to resolve the addresses logged by 'fn_*' events
+inline std::atomic_bool& memory_maps_saved() {
+  static std::atomic_bool saved(false);
+  return saved;
+}
+
+inline void save_memory_maps() {
+  if (memory_maps_saved().exchange(true)) {
+    return;
+  }
+  std::ifstream maps("/proc/self/maps");
+  std::ofstream output(
+    global_log_file_name_prefix() + std::to_string(::getpid()) + ".chrones.maps",
+    std::ios_base::trunc);
+  output << maps.rdbuf();
+}
+
+inline void prepare_fork() {
+  if (global_coordinator) {
+    global_coordinator->prepare_fork();
+  }
+}
+
+inline void after_fork_in_parent() {
+  if (global_coordinator) {
+    global_coordinator->after_fork_in_parent();
+  }
+}
+
+inline void after_fork_in_child() {
+  if (global_coordinator) {
+    // Log into a new file, named after the child's pid
+    global_stream().close();
+    global_stream().clear();
+    open_global_stream();
+    global_coordinator->after_fork_in_child();
+    memory_maps_saved() = false;
+  }
+}
+
+inline void dump_flight_recorder() {
+  if (global_coordinator) {
+    global_coordinator->dump_flight_recorder();
+  }
+}
+
+inline void handle_flight_recorder_signal(int) {
+  if (global_coordinator) {
+    global_coordinator->request_flight_recorder_dump();
+  }
+}
+
 inline std::unique_ptr<coordinator> make_global_coordinator(const char* name) {
   const char* const logs_directory = std::getenv("CHRONES_LOGS_DIRECTORY");
 
@@ -644,12 +2463,19 @@ inline std::unique_ptr<coordinator> make_global_coordinator(const char* name) {
     return nullptr;
   }
 
-  static std::ofstream stream(
-    std::string(logs_directory) + "/" + name + "." + std::to_string(::getpid()) + ".chrones.csv",
-    std::ios_base::app);
+  const CoordinatorSettings settings = CoordinatorSettings::from_environment();
+
+  global_log_file_name_prefix() = std::string(logs_directory) + "/" + name + ".";
+  global_log_file_name_suffix() = settings.log_block_size == 0 ? ".chrones.csv" : ".chrones.blocks";
+  open_global_stream();
+  ::pthread_atfork(&prepare_fork, &after_fork_in_parent, &after_fork_in_child);
+
+  if (settings.flight_recorder_events != 0) {
+    std::signal(SIGUSR2, &handle_flight_recorder_signal);
+  }
 
   // Don't use std::make_unique to support C++11
-  return std::unique_ptr<coordinator>(new coordinator(stream));
+  return std::unique_ptr<coordinator>(new coordinator(global_stream(), settings));
 }
 
 }  // namespace chrones
@@ -665,6 +2491,16 @@ inline std::unique_ptr<coordinator> make_global_coordinator(const char* name) {
 
 #define MINICHRONE(...)
 
+#define CHRONE_L(...)
+
+#define MINICHRONE_L(...)
+
+#define CHRONES_SET_WORK(...)
+
+#define CHRONES_SET_WORK_L(...)
+
+#define CHRONES_DUMP_FLIGHT_RECORDER()
+
 #else
 
 // @todo(later) Could we make sure at most one CHRONE() without label or index is defined in each function?
@@ -672,14 +2508,97 @@ inline std::unique_ptr<coordinator> make_global_coordinator(const char* name) {
 // @todo Provide non-variadic versions of these macros to support older compilers
 // (Define variadic macros inside '#if __cplusplus >= n' block)
 // Variadic macros that forwards their arguments to the appropriate constructors
-#define CHRONE(...) auto chrones_stopwatch_##__line__ = chrones::heavy_stopwatch( \
+// (They all declare the same variable, so 'CHRONES_SET_WORK' can refer to the innermost one of the current scope)
+#define CHRONES_STOPWATCH_VARIABLE chrones_stopwatch
+
+#define CHRONE(...) auto CHRONES_STOPWATCH_VARIABLE = chrones::heavy_stopwatch( \
   chrones::global_coordinator.get(), __PRETTY_FUNCTION__ \
   __VA_OPT__(,) __VA_ARGS__)  // NOLINT(whitespace/comma)
 
-#define MINICHRONE(...) auto chrones_stopwatch_##__line__ = chrones::light_stopwatch( \
+#define MINICHRONE(...) auto CHRONES_STOPWATCH_VARIABLE = chrones::light_stopwatch( \
   chrones::global_coordinator.get(), __PRETTY_FUNCTION__ \
   __VA_OPT__(,) __VA_ARGS__)  // NOLINT(whitespace/comma)
 
+// Set the amount of work (e.g. bytes or items) done by the innermost 'CHRONE' or 'MINICHRONE' of the current scope,
+// to report its throughput. Can be called anywhere before the end of the scope, e.g. just after 'CHRONE'.
+#define CHRONES_SET_WORK(work) CHRONES_STOPWATCH_VARIABLE.set_work(work)
+
+#define CHRONES_DUMP_FLIGHT_RECORDER() chrones::dump_flight_recorder()
+
+// Levels of detail: 'CHRONE_L(level, ...)' and 'MINICHRONE_L(level, ...)' are 'CHRONE(...)' and 'MINICHRONE(...)'
+// if 'level' is at most 'CHRONES_LEVEL', and expand to nothing otherwise.
+// 'level' must be an integer literal from 0 (coarsest) to 9 (finest). 'CHRONES_LEVEL' can be set per translation unit.
+#ifndef CHRONES_LEVEL
+#define CHRONES_LEVEL 9
+#endif
+
+#if CHRONES_LEVEL >= 0
+#define CHRONES_IF_LEVEL_0(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_0(...)
+#endif
+
+#if CHRONES_LEVEL >= 1
+#define CHRONES_IF_LEVEL_1(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_1(...)
+#endif
+
+#if CHRONES_LEVEL >= 2
+#define CHRONES_IF_LEVEL_2(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_2(...)
+#endif
+
+#if CHRONES_LEVEL >= 3
+#define CHRONES_IF_LEVEL_3(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_3(...)
+#endif
+
+#if CHRONES_LEVEL >= 4
+#define CHRONES_IF_LEVEL_4(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_4(...)
+#endif
+
+#if CHRONES_LEVEL >= 5
+#define CHRONES_IF_LEVEL_5(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_5(...)
+#endif
+
+#if CHRONES_LEVEL >= 6
+#define CHRONES_IF_LEVEL_6(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_6(...)
+#endif
+
+#if CHRONES_LEVEL >= 7
+#define CHRONES_IF_LEVEL_7(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_7(...)
+#endif
+
+#if CHRONES_LEVEL >= 8
+#define CHRONES_IF_LEVEL_8(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_8(...)
+#endif
+
+#if CHRONES_LEVEL >= 9
+#define CHRONES_IF_LEVEL_9(...) __VA_ARGS__
+#else
+#define CHRONES_IF_LEVEL_9(...)
+#endif
+
+#define CHRONE_L(level, ...) CHRONES_IF_LEVEL_##level(CHRONE(__VA_ARGS__))
+
+#define MINICHRONE_L(level, ...) CHRONES_IF_LEVEL_##level(MINICHRONE(__VA_ARGS__))
+
+// With the same 'level' as the 'CHRONE_L' or 'MINICHRONE_L'
+#define CHRONES_SET_WORK_L(level, work) CHRONES_IF_LEVEL_##level(CHRONES_SET_WORK(work))
+
 #endif
 
 #endif  // NO_CHRONES
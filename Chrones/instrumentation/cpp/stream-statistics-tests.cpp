@@ -33,6 +33,7 @@ TEST(StreamStatisticsTest, AllMetricsOnZeroElements) {
   EXPECT_TRUE(std::isnan(stats.median()));
   EXPECT_EQ(stats.max(), -std::numeric_limits<float>::max());
   EXPECT_EQ(stats.sum(), 0);
+  EXPECT_EQ(stats.self_sum(), 0);
 }
 
 TEST(StreamStatisticsTest, AllMetricsOnOneElements) {
@@ -47,6 +48,17 @@ TEST(StreamStatisticsTest, AllMetricsOnOneElements) {
   EXPECT_EQ(stats.median(), 2);
   EXPECT_EQ(stats.max(), 2);
   EXPECT_EQ(stats.sum(), 2);
+  EXPECT_EQ(stats.self_sum(), 2);
+}
+
+TEST(StreamStatisticsTest, SelfSum) {
+  StreamStatistics stats;
+  stats.update(4, 1);
+  stats.update(2, 2);
+
+  EXPECT_EQ(stats.mean(), 3);
+  EXPECT_EQ(stats.sum(), 6);
+  EXPECT_EQ(stats.self_sum(), 3);
 }
 
 TEST(StreamStatisticsTest, AllMetricsOnTwoElements) {
@@ -211,3 +223,15 @@ TEST(StreamStatisticsTest, VarianceOfManyEquidistantElements_16) {
     EXPECT_EQ(stats.variance(), 256);
   }
 }
+
+TEST(StreamStatisticsTest, Quantile) {
+  StreamStatistics stats;
+  for (int i = 100; i != 0; --i) {
+    stats.update(i);
+  }
+
+  EXPECT_EQ(stats.quantile(0), 1);
+  EXPECT_EQ(stats.quantile(0.5), 51);
+  EXPECT_EQ(stats.quantile(0.99), 100);
+  EXPECT_EQ(stats.quantile(1), 100);
+}
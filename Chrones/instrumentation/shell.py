@@ -6,19 +6,35 @@ from __future__ import annotations
 import os
 
 
-def enable(program_name):
+# The generated functions must not fork: '$(...)' and external commands cost about a millisecond each,
+# which is more than most of the steps they time.
+
+def enable(program_name, *, light=False):
     logs_directory = os.environ.get("CHRONES_LOGS_DIRECTORY")
 
     if logs_directory:
         yield f"chrones_filename={logs_directory}/{program_name}.$$.chrones.csv"
 
-        yield "function chrones_start {"
-        yield '  echo "$$,0,$(date +%s%N),sw_start,$1,${2:--},${3:--}" >>$chrones_filename'
-        yield "}"
+        # '$EPOCHREALTIME' exists since Bash 5.0. It's in microseconds, with a locale-dependent decimal separator.
+        yield 'if [ -n "${EPOCHREALTIME:-}" ]; then'
+        yield "  function chrones_time {"
+        yield "    chrones_now=${EPOCHREALTIME/[.,]/}000"
+        yield "  }"
+        yield "else"
+        yield "  function chrones_time {"
+        yield "    chrones_now=$(date +%s%N)"
+        yield "  }"
+        yield "fi"
 
-        yield "function chrones_stop {"
-        yield '  echo "$$,0,$(date +%s%N),sw_stop" >>$chrones_filename'
-        yield "}"
+        clock_offset = round(float(os.environ.get("CHRONES_CLOCK_OFFSET") or 0) * 1e9)
+        if clock_offset != 0:
+            yield "chrones_time"
+            yield f'echo "$$,0,$chrones_now,clock_offset,{clock_offset}" >>$chrones_filename'
+
+        if light:
+            yield from enable_light()
+        else:
+            yield from enable_heavy()
     else:
         yield "function chrones_start {"
         yield "  true"
@@ -27,3 +43,102 @@ def enable(program_name):
         yield "function chrones_stop {"
         yield "  true"
         yield "}"
+
+
+# File descriptor of the log for Bash older than 4.1
+fallback_fd = 219
+
+
+def enable_heavy():
+    # Keep the log open instead of re-opening it for each event. '{var}>' exists since Bash 4.1.
+    # Before that, use a fixed fd, documented in the README, high enough to be unlikely used by scripts.
+    yield "if (( BASH_VERSINFO[0] > 4 || (BASH_VERSINFO[0] == 4 && BASH_VERSINFO[1] >= 1) )); then"
+    yield "  eval 'exec {chrones_fd}>>$chrones_filename'"
+    yield "else"
+    yield f"  chrones_fd={fallback_fd}"
+    yield f"  exec {fallback_fd}>>$chrones_filename"
+    yield "fi"
+
+    yield "function chrones_start {"
+    yield "  chrones_time"
+    yield '  echo "$$,0,$chrones_now,sw_start,$1,${2:--},${3:--}" >&$chrones_fd'
+    yield "}"
+
+    yield "function chrones_stop {"
+    yield "  chrones_time"
+    yield '  echo "$$,0,$chrones_now,sw_stop" >&$chrones_fd'
+    yield "}"
+
+
+def enable_light():
+    # Like 'MINICHRONE' in C++: aggregate durations in memory, by name and label, and log their summaries on exit.
+    # Sums of squares are in microseconds squared to delay overflows.
+    yield "declare -A chrones_counts=() chrones_sums=() chrones_self_sums=() chrones_squares=() chrones_mins=() chrones_maxs=()"
+    yield "chrones_stack_keys=()"
+    yield "chrones_stack_starts=()"
+    yield "chrones_stack_children=()"
+
+    yield "function chrones_start {"
+    yield "  chrones_time"
+    yield '  chrones_stack_keys+=("$1,${2:--}")'
+    yield "  chrones_stack_starts+=($chrones_now)"
+    yield "  chrones_stack_children+=(0)"
+    yield "}"
+
+    yield "function chrones_stop {"
+    yield "  chrones_time"
+    yield "  local i=$((${#chrones_stack_keys[@]} - 1))"
+    yield "  local key=${chrones_stack_keys[i]}"
+    yield "  local duration=$((chrones_now - chrones_stack_starts[i]))"
+    yield "  local self_duration=$((duration - chrones_stack_children[i]))"
+    yield '  unset "chrones_stack_keys[i]" "chrones_stack_starts[i]" "chrones_stack_children[i]"'
+    yield "  if ((i > 0)); then"
+    yield "    chrones_stack_children[i - 1]=$((chrones_stack_children[i - 1] + duration))"
+    yield "  fi"
+    yield "  chrones_counts[$key]=$((${chrones_counts[$key]:-0} + 1))"
+    yield "  chrones_sums[$key]=$((${chrones_sums[$key]:-0} + duration))"
+    yield "  chrones_self_sums[$key]=$((${chrones_self_sums[$key]:-0} + self_duration))"
+    yield "  chrones_squares[$key]=$((${chrones_squares[$key]:-0} + (duration / 1000) * (duration / 1000)))"
+    yield "  if ((duration < ${chrones_mins[$key]:-$duration + 1})); then"
+    yield "    chrones_mins[$key]=$duration"
+    yield "  fi"
+    yield "  if ((duration > ${chrones_maxs[$key]:--1})); then"
+    yield "    chrones_maxs[$key]=$duration"
+    yield "  fi"
+    yield "}"
+
+    # Integer square root, by Newton's method
+    yield "function chrones_sqrt {"
+    yield "  local x=$1"
+    yield "  local y=$(((x + 1) / 2))"
+    yield "  while ((y < x)); do"
+    yield "    x=$y"
+    yield "    y=$(((x + $1 / x) / 2))"
+    yield "  done"
+    yield "  chrones_root=$x"
+    yield "}"
+
+    # The median is not known without keeping all durations: it's left empty
+    yield "function chrones_summarize {"
+    yield "  chrones_time"
+    yield "  local key count mean variance"
+    yield '  for key in "${!chrones_counts[@]}"; do'
+    yield "    count=${chrones_counts[$key]}"
+    yield "    mean=$((${chrones_sums[$key]} / count))"
+    yield "    variance=$((${chrones_squares[$key]} / count - (mean / 1000) * (mean / 1000)))"
+    yield "    chrones_sqrt $((variance > 0 ? variance : 0))"
+    yield '    echo "$$,0,$chrones_now,sw_summary,$key,$count,$mean,$((chrones_root * 1000)),${chrones_mins[$key]},,${chrones_maxs[$key]},${chrones_sums[$key]},${chrones_self_sums[$key]}"'
+    yield "  done >>$chrones_filename"
+    yield "}"
+
+    # Chain with the script's own EXIT trap, if it's set before enabling Chrones, and keep the exit code for it.
+    # '$(trap -p EXIT)' gives the trap of the current shell, not of the subshell.
+    yield "function chrones_set_previous_exit_trap {"
+    yield "  chrones_previous_exit_trap=$2"
+    yield "}"
+    yield "function chrones_return {"
+    yield "  return $1"
+    yield "}"
+    yield "chrones_previous_exit_trap=$(trap -p EXIT)"
+    yield 'eval "chrones_set_previous_exit_trap ${chrones_previous_exit_trap#trap }"'
+    yield "trap 'chrones_status=$?; chrones_summarize; chrones_return $chrones_status; eval \"$chrones_previous_exit_trap\"' EXIT"
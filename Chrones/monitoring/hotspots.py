@@ -0,0 +1,249 @@
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+from __future__ import annotations
+
+from typing import Dict, List, Optional, Tuple
+import csv
+import dataclasses
+import glob
+import io
+import os
+import sys
+import tempfile
+import unittest
+
+from .result import ClockOffset, LockSummary, OsThread, StopwatchExemplar, StopwatchStart, StopwatchStop, StopwatchSummary, Telemetry, make_chrone_event
+from .symbols import AddressResolver, resolve_function_addresses
+from ..reporting.summaries import make_stopwatch_start, make_stopwatch_stop
+
+
+class LogsTailer:
+    """Incrementally read the complete lines appended to the '*.chrones.csv' files of the given processes"""
+
+    def __init__(self, logs_directory):
+        self.__logs_directory = logs_directory
+        self.__offsets = {}  # Keep files of terminated processes: their last lines may not have been read yet
+        self.__partial_lines = {}
+        self.__resolvers = {}
+
+    def read_new_events(self, pids):
+        pids = set(str(pid) for pid in pids)
+        for file_name in glob.glob(os.path.join(self.__logs_directory, "*.chrones.csv")):
+            if file_name not in self.__offsets and file_name.split(".")[-3] in pids:
+                self.__offsets[file_name] = 0
+
+        for (file_name, offset) in self.__offsets.items():
+            with open(file_name, "rb") as f:
+                f.seek(offset)
+                data = f.read()
+            if not data:
+                continue
+            self.__offsets[file_name] = offset + len(data)
+
+            data = self.__partial_lines.pop(file_name, b"") + data
+            end = data.rfind(b"\n") + 1
+            if end != len(data):
+                # The instrumented program is in the middle of writing this line
+                self.__partial_lines[file_name] = data[end:]
+            lines = csv.reader(io.StringIO(data[:end].decode()))
+            resolver = self.__resolvers.setdefault(file_name, AddressResolver(file_name[:-len(".csv")] + ".maps"))
+            for line in resolve_function_addresses(lines, resolver):
+                yield make_chrone_event(line)
+
+
+@dataclasses.dataclass
+class Hotspot:
+    function_name: str
+    label: Optional[str]
+    executions_count: int
+    total_duration: float
+    self_duration: float
+
+    @property
+    def name(self):
+        return self.function_name if self.label is None else f"{self.function_name} - {self.label}"
+
+
+class HotspotsAggregator:
+    @dataclasses.dataclass
+    class Frame:
+        start_event: StopwatchStart
+        children_duration: float
+
+    def __init__(self):
+        self.__stacks: Dict[Tuple[str, str], List[HotspotsAggregator.Frame]] = {}
+        self.__hotspots: Dict[Tuple[str, str], Hotspot] = {}
+        self.__last_timestamp = None
+
+    def process(self, event):
+        self.__last_timestamp = event.timestamp if self.__last_timestamp is None else max(self.__last_timestamp, event.timestamp)
+
+        stack = self.__stacks.setdefault((event.process_id, event.thread_id), [])
+        if event.__class__ == StopwatchStart:
+            stack.append(HotspotsAggregator.Frame(event, 0))
+        elif event.__class__ == StopwatchStop:
+            frame = stack.pop()
+            duration = event.timestamp - frame.start_event.timestamp
+            self.__add(self.__hotspots, frame.start_event.function_name, frame.start_event.label, 1, duration, duration - frame.children_duration)
+            if stack:
+                stack[-1].children_duration += duration
+        elif event.__class__ == StopwatchSummary:
+            if not event.for_all_indexes:
+                return  # Already counted in the summary for all indexes
+            # Light stopwatches didn't report their self time before version 1.1.1: count their total time as self time
+            self_duration = event.total_duration if event.self_duration is None else event.self_duration
+            self.__add(self.__hotspots, event.function_name, event.label, event.executions_count, event.total_duration / 1e9, self_duration / 1e9)
+        elif event.__class__ in (ClockOffset, OsThread, Telemetry, LockSummary, StopwatchExemplar):
+            pass
+        else:
+            assert False
+
+    def get_hotspots(self, now=None):
+        """Return the hotspots, including the elapsed time of stopwatches that are still running at 'now'"""
+        if now is None:
+            now = self.__last_timestamp
+
+        hotspots = {key: dataclasses.replace(hotspot) for (key, hotspot) in self.__hotspots.items()}
+        for stack in self.__stacks.values():
+            for (frame, child_frame) in zip(stack, stack[1:] + [None]):
+                duration = max(0, now - frame.start_event.timestamp)
+                self_duration = duration - frame.children_duration
+                if child_frame is not None:
+                    self_duration -= max(0, now - child_frame.start_event.timestamp)
+                self.__add(hotspots, frame.start_event.function_name, frame.start_event.label, 0, duration, self_duration)
+        return list(hotspots.values())
+
+    @staticmethod
+    def __add(hotspots, function_name, label, executions_count, total_duration, self_duration):
+        hotspot = hotspots.setdefault((function_name, label), Hotspot(function_name, label, 0, 0, 0))
+        hotspot.executions_count += executions_count
+        hotspot.total_duration += total_duration
+        hotspot.self_duration += self_duration
+
+
+class LiveHotspots:
+    def __init__(self, logs_directory, *, top, output=sys.stderr):
+        self.__top = top
+        self.__output = output
+        self.__tailer = LogsTailer(logs_directory)
+        self.__aggregator = HotspotsAggregator()
+
+    def update(self, pids):
+        for event in self.__tailer.read_new_events(pids):
+            self.__aggregator.process(event)
+
+    def print(self, now, origin):
+        hotspots = self.__aggregator.get_hotspots(now)
+        print(f"Chrones: hotspots at t={now - origin:.3f}s", file=self.__output)
+        for (title, key) in [("total", lambda h: h.total_duration), ("self", lambda h: h.self_duration)]:
+            print(f"  By {title} time:", file=self.__output)
+            print(f"    {'Total (s)':>10} {'Self (s)':>10} {'Count':>8}  Function", file=self.__output)
+            for hotspot in sorted(hotspots, key=key, reverse=True)[:self.__top]:
+                print(f"    {hotspot.total_duration:10.3f} {hotspot.self_duration:10.3f} {hotspot.executions_count:8}  {hotspot.name}", file=self.__output)
+        self.__output.flush()
+
+
+class HotspotsAggregatorTestCase(unittest.TestCase):
+    def get_hotspots(self, events, now=None):
+        aggregator = HotspotsAggregator()
+        for event in events:
+            aggregator.process(event)
+        return sorted(aggregator.get_hotspots(now), key=lambda h: h.name)
+
+    def test_empty(self):
+        self.assertEqual(self.get_hotspots([], 0), [])
+
+    def test_nested(self):
+        self.assertEqual(
+            self.get_hotspots([
+                make_stopwatch_start("p", "t", 10, "f", None),
+                make_stopwatch_start("p", "t", 12, "g", None),
+                make_stopwatch_stop("p", "t", 15),
+                make_stopwatch_start("p", "t", 16, "g", None),
+                make_stopwatch_stop("p", "t", 17),
+                make_stopwatch_stop("p", "t", 20),
+            ]),
+            [
+                Hotspot("f", None, 1, 10, 6),
+                Hotspot("g", None, 2, 4, 4),
+            ],
+        )
+
+    def test_threads_are_independent(self):
+        self.assertEqual(
+            self.get_hotspots([
+                make_stopwatch_start("p", "t_a", 10, "f", None),
+                make_stopwatch_start("p", "t_b", 12, "g", None),
+                make_stopwatch_stop("p", "t_a", 15),
+                make_stopwatch_stop("p", "t_b", 20),
+            ]),
+            [
+                Hotspot("f", None, 1, 5, 5),
+                Hotspot("g", None, 1, 8, 8),
+            ],
+        )
+
+    def test_running_stopwatches(self):
+        self.assertEqual(
+            self.get_hotspots(
+                [
+                    make_stopwatch_start("p", "t", 10, "f", None),
+                    make_stopwatch_start("p", "t", 12, "g", "label"),
+                    make_stopwatch_stop("p", "t", 15),
+                    make_stopwatch_start("p", "t", 16, "g", "label"),
+                ],
+                now=20,
+            ),
+            [
+                Hotspot("f", None, 0, 10, 3),
+                Hotspot("g", "label", 1, 7, 7),
+            ],
+        )
+
+    def test_summary(self):
+        self.assertEqual(
+            self.get_hotspots([
+                StopwatchSummary(
+                    process_id="p", thread_id="t", timestamp=42, function_name="f", label=None,
+                    executions_count=3, average_duration=2_000_000_000, duration_standard_deviation=0,
+                    min_duration=2_000_000_000, median_duration=2_000_000_000, max_duration=2_000_000_000,
+                    total_duration=6_000_000_000,
+                ),
+            ]),
+            [
+                Hotspot("f", None, 3, 6, 6),
+            ],
+        )
+
+    def test_summary_with_self_duration(self):
+        self.assertEqual(
+            self.get_hotspots([
+                StopwatchSummary(
+                    process_id="p", thread_id="t", timestamp=42, function_name="f", label=None,
+                    executions_count=3, average_duration=2_000_000_000, duration_standard_deviation=0,
+                    min_duration=2_000_000_000, median_duration=2_000_000_000, max_duration=2_000_000_000,
+                    total_duration=6_000_000_000, self_duration=1_000_000_000,
+                ),
+            ]),
+            [
+                Hotspot("f", None, 3, 6, 1),
+            ],
+        )
+
+
+class LogsTailerTestCase(unittest.TestCase):
+    def test_partial_lines(self):
+        with tempfile.TemporaryDirectory() as logs_directory:
+            tailer = LogsTailer(logs_directory)
+            file_name = os.path.join(logs_directory, "program.42.chrones.csv")
+            self.assertEqual(list(tailer.read_new_events([42])), [])
+
+            with open(file_name, "w") as f:
+                f.write('42,0,1000000000,sw_start,"f",-,-\n42,0,20000')
+            self.assertEqual(list(tailer.read_new_events([42])), [make_stopwatch_start("42", "0", 1, "f", None)])
+            self.assertEqual(list(tailer.read_new_events([])), [])
+
+            with open(file_name, "a") as f:
+                f.write('00000,sw_stop\n')
+            self.assertEqual(list(tailer.read_new_events([])), [make_stopwatch_stop("42", "0", 2)])
@@ -0,0 +1,143 @@
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+# Reader for the block log format. See 'BlockLogWriter' in 'chrones.hpp' for its description.
+
+from __future__ import annotations
+
+import csv
+import dataclasses
+import io
+import struct
+import unittest
+import zlib
+
+
+HEADER = struct.Struct("<4sBIIIiqq")
+MAGIC = b"CHRB"
+CODEC_NONE = 0
+CODEC_ZLIB = 1
+
+
+@dataclasses.dataclass(frozen=True)
+class BlockHeader:
+    codec: int
+    stored_size: int
+    raw_size: int
+    events_count: int
+    process_id: int
+    min_time: int
+    max_time: int
+
+
+def iter_blocks(f, min_time=None, max_time=None):
+    """
+    Yield '(header, raw_block)' for each block of the file, one at a time.
+
+    Blocks entirely before 'min_time' or after 'max_time' (in nanoseconds) are skipped without being read.
+    """
+    while True:
+        header_data = f.read(HEADER.size)
+        if len(header_data) < HEADER.size:
+            return  # End of file, or incomplete block still being written
+        (magic, *fields) = HEADER.unpack(header_data)
+        assert magic == MAGIC
+        header = BlockHeader(*fields)
+
+        if (min_time is not None and header.max_time < min_time) or (max_time is not None and header.min_time > max_time):
+            f.seek(header.stored_size, io.SEEK_CUR)
+            continue
+
+        stored = f.read(header.stored_size)
+        if len(stored) < header.stored_size:
+            return
+        if header.codec == CODEC_NONE:
+            raw = stored
+        elif header.codec == CODEC_ZLIB:
+            raw = zlib.decompress(stored)
+        else:
+            assert False
+        assert len(raw) == header.raw_size
+        yield (header, raw)
+
+
+def iter_lines(f, min_time=None, max_time=None):
+    """Yield the events of a block log file as the lines of the equivalent CSV log file, already split in fields"""
+    for (header, raw) in iter_blocks(f, min_time, max_time):
+        yield from decode_block(header, raw)
+
+
+def decode_block(header, raw):
+    threads = []
+    last_times = []
+    position = 0
+
+    def read_varint():
+        nonlocal position
+        value = 0
+        shift = 0
+        while True:
+            byte = raw[position]
+            position += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if byte < 0x80:
+                return value
+
+    for _ in range(header.events_count):
+        slot = read_varint()
+        if slot == len(threads):
+            threads.append(read_varint())
+            last_times.append(0)
+        zigzag = read_varint()
+        last_times[slot] += (zigzag >> 1) ^ -(zigzag & 1)
+        size = read_varint()
+        attributes = raw[position:position + size].decode()
+        position += size
+        yield next(csv.reader([f"{header.process_id},{threads[slot]},{last_times[slot]}{attributes}"]))
+    assert position == len(raw)
+
+
+class IterLinesTestCase(unittest.TestCase):
+    # Same data as in the 'BlockLog' test of 'chrones-tests.cpp'
+    raw = (
+        b"\x00\xAC\x02\x0A\x0C,os_thread,0"
+        b"\x00\x00\x11,sw_start,\"f\",-,-"
+        b"\x00\x14\x08,sw_stop"
+    )
+
+    def make_block(self, codec, raw, min_time=5, max_time=15):
+        stored = zlib.compress(raw) if codec == CODEC_ZLIB else raw
+        return HEADER.pack(MAGIC, codec, len(stored), len(raw), 3, 8, min_time, max_time) + stored
+
+    def test_uncompressed(self):
+        f = io.BytesIO(self.make_block(CODEC_NONE, self.raw))
+        self.assertEqual(
+            list(iter_lines(f)),
+            [
+                ["8", "300", "5", "os_thread", "0"],
+                ["8", "300", "5", "sw_start", "f", "-", "-"],
+                ["8", "300", "15", "sw_stop"],
+            ],
+        )
+
+    def test_compressed(self):
+        f = io.BytesIO(self.make_block(CODEC_ZLIB, self.raw))
+        self.assertEqual(len(list(iter_lines(f))), 3)
+
+    def test_negative_delta(self):
+        raw = b"\x00\x01\x14\x08,sw_stop" + b"\x00\x03\x08,sw_stop"
+        f = io.BytesIO(HEADER.pack(MAGIC, CODEC_NONE, len(raw), len(raw), 2, 8, 8, 10) + raw)
+        self.assertEqual([line[2] for line in iter_lines(f)], ["10", "8"])
+
+    def test_skip_blocks(self):
+        f = io.BytesIO(
+            self.make_block(CODEC_ZLIB, self.raw, 5, 15)
+            + self.make_block(CODEC_ZLIB, self.raw, 20, 30)
+            + self.make_block(CODEC_ZLIB, self.raw, 35, 45)
+        )
+        self.assertEqual([header.min_time for (header, _) in iter_blocks(f, min_time=16, max_time=30)], [20])
+
+    def test_incomplete_block(self):
+        f = io.BytesIO(self.make_block(CODEC_NONE, self.raw)[:-1])
+        self.assertEqual(list(iter_lines(f)), [])
@@ -0,0 +1,335 @@
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+from __future__ import annotations
+
+from typing import List, NamedTuple
+import dataclasses
+import os
+import subprocess
+import threading
+import time
+import unittest
+
+
+# These mimic the psutil named tuples used by the runner, so both samplers are interchangeable
+
+class MemoryInfo(NamedTuple):
+    rss: int
+
+
+class InputOutputCounters(NamedTuple):
+    read_chars: int
+    write_chars: int
+
+
+class ContextSwitches(NamedTuple):
+    voluntary: int
+    involuntary: int
+
+
+class ProcessSample(NamedTuple):
+    threads: int
+    cpu_percent: float
+    user_time: float
+    system_time: float
+    memory: MemoryInfo
+    open_files: int
+    io: InputOutputCounters
+    context_switches: ContextSwitches
+
+
+clock_ticks = os.sysconf("SC_CLK_TCK")
+page_size = os.sysconf("SC_PAGE_SIZE")
+
+
+class ProcSampler:
+    """
+    Sample processes by reading their '/proc/<pid>/...' files directly.
+
+    Files are opened once when monitoring starts and re-read with 'pread', and we parse only the fields we need.
+    This is much cheaper than psutil, which re-opens and fully parses several files for each metric.
+    Counting open files costs a 'readlink' per file descriptor, so it's refreshed every 'open_files_interval' seconds.
+    We raise 'ProcessLookupError' when a process has terminated, and 'PermissionError' when some metrics can't be read.
+    """
+
+    @dataclasses.dataclass
+    class Process:
+        stat_fd: int
+        statm_fd: int
+        io_fd: int
+        status_fd: int
+        previous_timestamp: float
+        previous_cpu_time: float
+        open_files: int = 0
+        open_files_timestamp: float = float("-inf")
+
+    def __init__(self, open_files_interval=0.1):
+        self.__processes = {}
+        self.__open_files_interval = open_files_interval
+        self.__children_files_supported = os.path.exists(f"/proc/{os.getpid()}/task/{os.getpid()}/children")
+
+    def start(self, pid) -> List[str]:
+        fds = []
+        try:
+            for name in ["stat", "statm", "io", "status"]:
+                try:
+                    fds.append(open_proc_file(f"/proc/{pid}/{name}"))
+                except PermissionError:  # E.g. '/proc/<pid>/io' of a setuid program
+                    fds.append(None)
+            with open(f"/proc/{pid}/cmdline", "rb") as f:
+                command = [part.decode(errors="replace") for part in f.read().split(b"\0")[:-1]]
+            stat = read_stat(fds[0])
+        except ProcessLookupError:
+            close_proc_files(fds)
+            raise
+        self.__processes[pid] = ProcSampler.Process(*fds, time.monotonic(), get_cpu_time(stat))
+        return command
+
+    def stop(self, pid):
+        process = self.__processes.pop(pid)
+        close_proc_files([process.stat_fd, process.statm_fd, process.io_fd, process.status_fd])
+
+    def sample(self, pid) -> ProcessSample:
+        process = self.__processes[pid]
+
+        timestamp = time.monotonic()
+        stat = read_stat(process.stat_fd)
+        if stat[0] == b"Z":
+            raise ProcessLookupError(pid)
+        cpu_time = get_cpu_time(stat)
+        if timestamp > process.previous_timestamp:
+            cpu_percent = 100 * (cpu_time - process.previous_cpu_time) / (timestamp - process.previous_timestamp)
+        else:
+            cpu_percent = 0.
+        process.previous_timestamp = timestamp
+        process.previous_cpu_time = cpu_time
+        if timestamp - process.open_files_timestamp >= self.__open_files_interval:
+            process.open_files = self.__count_open_files(pid)
+            process.open_files_timestamp = timestamp
+
+        statm = read_proc_file(process.statm_fd).split(b" ", 2)
+        io = read_fields(process.io_fd, [b"rchar:", b"wchar:"])
+        status = read_fields(process.status_fd, [b"voluntary_ctxt_switches:", b"nonvoluntary_ctxt_switches:"])
+
+        return ProcessSample(
+            threads=int(stat[17]),
+            cpu_percent=cpu_percent,
+            user_time=int(stat[11]) / clock_ticks,
+            system_time=int(stat[12]) / clock_ticks,
+            memory=MemoryInfo(rss=int(statm[1]) * page_size),
+            open_files=process.open_files,
+            io=InputOutputCounters(read_chars=io[0], write_chars=io[1]),
+            context_switches=ContextSwitches(voluntary=status[0], involuntary=status[1]),
+        )
+
+    def children(self, pid) -> List[int]:
+        try:
+            if self.__children_files_supported:
+                children = []
+                for tid in os.listdir(f"/proc/{pid}/task"):
+                    try:
+                        with open(f"/proc/{pid}/task/{tid}/children", "rb") as f:
+                            children += [int(child) for child in f.read().split()]
+                    except FileNotFoundError:
+                        pass  # This thread just terminated
+                return children
+            else:
+                return [child for (child, parent) in self.__list_parents() if parent == pid]
+        except FileNotFoundError:
+            raise ProcessLookupError(pid)
+
+    @staticmethod
+    def __list_parents():
+        for entry in os.listdir("/proc"):
+            if entry.isdigit():
+                try:
+                    with open(f"/proc/{entry}/stat", "rb") as f:
+                        yield (int(entry), int(f.read().rsplit(b")", 1)[1].split(b" ", 3)[2]))
+                except (FileNotFoundError, ProcessLookupError):
+                    pass
+
+    @staticmethod
+    def __count_open_files(pid):
+        # Like psutil, count only regular files
+        count = 0
+        try:
+            for fd in os.listdir(f"/proc/{pid}/fd"):
+                try:
+                    path = os.readlink(f"/proc/{pid}/fd/{fd}")
+                except FileNotFoundError:
+                    continue  # This file was just closed
+                if path.startswith("/") and not path.startswith("/dev/") and not path.endswith(" (deleted)"):
+                    count += 1
+        except FileNotFoundError:
+            raise ProcessLookupError(pid)
+        return count
+
+
+def get_cpu_time(stat):
+    return (int(stat[11]) + int(stat[12])) / clock_ticks
+
+
+def read_stat(fd):
+    # The process name can contain spaces and parentheses: skip it by looking for the *last* ')'.
+    # Then index 0 is field (3) 'state' in proc(5), index 11 is field (14) 'utime', etc.
+    return read_proc_file(fd).rsplit(b")", 1)[1].split()
+
+
+def read_fields(fd, names):
+    data = b"\n" + read_proc_file(fd)
+    values = []
+    for name in names:
+        start = data.index(b"\n" + name) + 1 + len(name)
+        values.append(int(data[start:data.index(b"\n", start)]))
+    return values
+
+
+def close_proc_files(fds):
+    for fd in fds:
+        if fd is not None:
+            os.close(fd)
+
+
+def open_proc_file(path):
+    try:
+        return os.open(path, os.O_RDONLY)
+    except FileNotFoundError:
+        raise ProcessLookupError(path)
+
+
+def read_proc_file(fd):
+    if fd is None:
+        raise PermissionError()
+    try:
+        return os.pread(fd, 4096, 0)
+    except (ProcessLookupError, PermissionError):  # ProcessLookupError is ESRCH: the process has been reaped
+        raise
+    except OSError as e:
+        raise ProcessLookupError(e)
+
+
+class ThreadSample(NamedTuple):
+    os_thread_id: int
+    state: str
+    user_time: float
+    system_time: float
+    last_cpu: int
+    context_switches: ContextSwitches
+
+
+class ThreadsSampler:
+    """
+    Sample each thread of processes by reading their '/proc/<pid>/task/<tid>/...' files.
+
+    Like 'ProcSampler', we open files once per thread and re-read them with 'pread'.
+    """
+
+    def __init__(self):
+        self.__threads = {}
+
+    def sample(self, pid) -> List[ThreadSample]:
+        threads = self.__threads.setdefault(pid, {})
+        try:
+            tids = set(int(tid) for tid in os.listdir(f"/proc/{pid}/task"))
+        except FileNotFoundError:
+            raise ProcessLookupError(pid)
+
+        for tid in set(threads.keys()) - tids:
+            close_proc_files(threads.pop(tid))
+
+        samples = []
+        for tid in sorted(tids):
+            try:
+                fds = threads.get(tid)
+                if fds is None:
+                    fds = []
+                    try:
+                        for name in ["stat", "status"]:
+                            fds.append(open_proc_file(f"/proc/{pid}/task/{tid}/{name}"))
+                    except ProcessLookupError:
+                        close_proc_files(fds)
+                        raise
+                    threads[tid] = fds
+                stat = read_stat(fds[0])
+                context_switches = read_fields(fds[1], [b"voluntary_ctxt_switches:", b"nonvoluntary_ctxt_switches:"])
+            except ProcessLookupError:
+                continue  # This thread just terminated
+            samples.append(ThreadSample(
+                os_thread_id=tid,
+                state=stat[0].decode(),
+                user_time=int(stat[11]) / clock_ticks,
+                system_time=int(stat[12]) / clock_ticks,
+                last_cpu=int(stat[36]),  # Field (39) 'processor'
+                context_switches=ContextSwitches(voluntary=context_switches[0], involuntary=context_switches[1]),
+            ))
+        return samples
+
+    def stop(self, pid):
+        for fds in self.__threads.pop(pid, {}).values():
+            close_proc_files(fds)
+
+
+class ProcSamplerTestCase(unittest.TestCase):
+    def test_sample_self(self):
+        sampler = ProcSampler()
+        pid = os.getpid()
+        command = sampler.start(pid)
+        try:
+            self.assertGreater(len(command), 0)
+            with open(__file__):
+                sample = sampler.sample(pid)
+            self.assertGreaterEqual(sample.threads, 1)
+            self.assertGreaterEqual(sample.cpu_percent, 0)
+            self.assertGreater(sample.user_time + sample.system_time, 0)
+            self.assertGreater(sample.memory.rss, 0)
+            self.assertGreaterEqual(sample.open_files, 1)
+            self.assertGreater(sample.io.read_chars, 0)
+            self.assertGreater(sample.context_switches.voluntary + sample.context_switches.involuntary, 0)
+        finally:
+            sampler.stop(pid)
+
+    def test_open_files_interval(self):
+        pid = os.getpid()
+        for (open_files_interval, expected_difference) in [(0, 1), (3600, 0)]:
+            sampler = ProcSampler(open_files_interval=open_files_interval)
+            sampler.start(pid)
+            try:
+                before = sampler.sample(pid).open_files
+                with open(__file__):
+                    self.assertEqual(sampler.sample(pid).open_files, before + expected_difference)
+            finally:
+                sampler.stop(pid)
+
+    def test_children_and_termination(self):
+        sampler = ProcSampler()
+        child = subprocess.Popen(["sleep", "10"])
+        time.sleep(0.1)  # Let the child 'exec'
+        try:
+            self.assertIn(child.pid, sampler.children(os.getpid()))
+            self.assertEqual(sampler.start(child.pid), ["sleep", "10"])
+            self.assertEqual(sampler.sample(child.pid).threads, 1)
+        finally:
+            child.kill()
+            child.wait()
+        with self.assertRaises(ProcessLookupError):
+            sampler.sample(child.pid)
+        sampler.stop(child.pid)
+
+    def test_threads(self):
+        sampler = ThreadsSampler()
+        pid = os.getpid()
+        done = threading.Event()
+        thread = threading.Thread(target=done.wait)
+        thread.start()
+        try:
+            samples = sampler.sample(pid)
+            self.assertEqual(len(samples), threading.active_count())
+            self.assertEqual(samples[0].os_thread_id, pid)
+            self.assertIn(thread.native_id, [sample.os_thread_id for sample in samples])
+            self.assertGreaterEqual(samples[0].last_cpu, 0)
+        finally:
+            done.set()
+            thread.join()
+        self.assertEqual(len(sampler.sample(pid)), threading.active_count())
+        sampler.stop(pid)
@@ -15,6 +15,9 @@ import unittest
 
 import dacite
 
+from . import log_blocks
+from . import symbols
+
 
 if sys.version_info < (3, 10):
     dataclass = dataclasses.dataclass(frozen=True)
@@ -41,6 +44,16 @@ class ContextSwitchInstantMetrics:
     involuntary: int
 
 
+@dataclass
+class ThreadInstantMetrics:
+    os_thread_id: int
+    state: str
+    user_time: float
+    system_time: float
+    last_cpu: int
+    context_switches: ContextSwitchInstantMetrics
+
+
 @dataclass
 class ProcessInstantMetrics:
     timestamp: float
@@ -54,6 +67,8 @@ class ProcessInstantMetrics:
     context_switches: ContextSwitchInstantMetrics
     gpu_percent: Optional[float]
     gpu_memory: Optional[float]
+    # Added after version 1.1.1, so optional to keep loading files in format_version 1
+    threads_metrics: Optional[List[ThreadInstantMetrics]] = None
 
 
 @dataclass
@@ -63,6 +78,30 @@ class ChroneEvent:
     timestamp: int
 
 
+@dataclass
+class ClockOffset(ChroneEvent):
+    offset: float
+
+
+@dataclass
+class OsThread(ChroneEvent):
+    os_thread_id: int
+
+
+@dataclass
+class Telemetry(ChroneEvent):
+    """What the C++ instrumentation itself cost, since the start of the process"""
+    events_count: int
+    bytes_count: int
+    flushes_count: int
+    flushes_duration: float
+    peak_backlog: int
+    contentions_count: int
+    contentions_duration: float
+    overwritten_events_count: int
+    worker_cpu_time: float
+
+
 @dataclass
 class StopwatchStart(ChroneEvent):
     function_name: str
@@ -72,7 +111,21 @@ class StopwatchStart(ChroneEvent):
 
 @dataclass
 class StopwatchStop(ChroneEvent):
-    pass
+    # Amount of work (e.g. bytes or items) done by the stopwatch, if given with 'CHRONES_SET_WORK'
+    work: Optional[float] = None
+
+
+@dataclass
+class StopwatchExemplar(ChroneEvent):
+    """A slow execution of a light stopwatch, already accounted for in its summary. 'timestamp' is when it stopped"""
+    function_name: str
+    label: Optional[str]
+    index: Optional[int]
+    duration: float
+
+    @property
+    def start_timestamp(self):
+        return self.timestamp - self.duration
 
 
 @dataclass
@@ -83,9 +136,43 @@ class StopwatchSummary(ChroneEvent):
     average_duration: int
     duration_standard_deviation: int
     min_duration: int
-    median_duration: int
+    # Unknown for the shell's light mode, which doesn't keep all durations
+    median_duration: Optional[int]
     max_duration: int
     total_duration: int
+    # Time not spent in nested light stopwatches. Not logged before version 1.1.1
+    self_duration: Optional[int] = None
+    # Light stopwatches with an index log a summary for all their executions,
+    # then one for each of their first indexes, then one for all their other indexes
+    index: Optional[int] = None
+    other_indexes: bool = False
+    percentile_99_duration: Optional[int] = None
+    # Of the executions with an amount of work (see 'StopwatchStop.work'), throughputs in work per second
+    work_executions_count: Optional[int] = None
+    total_work: Optional[float] = None
+    average_throughput: Optional[float] = None  # Total work divided by the duration of these executions
+    min_throughput: Optional[float] = None
+    median_throughput: Optional[float] = None
+    percentile_1_throughput: Optional[float] = None
+
+    @property
+    def for_all_indexes(self):
+        return self.index is None and not self.other_indexes
+
+
+@dataclass
+class LockSummary(ChroneEvent):
+    """Acquisitions of a 'chrones::mutex' or 'chrones::shared_mutex', in one mode, since the previous summary"""
+    name: str
+    mode: str  # "exclusive" or "shared"
+    acquisitions_count: int
+    contended_acquisitions_count: int
+    # Of contended acquisitions: the others don't wait
+    total_wait_duration: float
+    max_wait_duration: float
+    total_hold_duration: float
+    max_hold_duration: float
+    percentile_99_hold_duration: float
 
 
 @dataclass
@@ -104,6 +191,9 @@ class Process:
     def load_chrone_events(self):
         return load_chrone_events(self.pid)
 
+    def load_chrone_thread_starts(self):
+        return load_chrone_thread_starts(self.pid)
+
 
 @dataclass
 class MainProcessGlobalMetrics:
@@ -138,6 +228,7 @@ class System:
 @dataclass
 class RunSettings:
     gpu_monitored: bool
+    threads_monitored: bool = False
 
 
 @dataclass
@@ -163,14 +254,68 @@ class RunResults:
         return dacite.from_dict(data_class=cls, data=data, config=dacite.Config(cast=[Tuple]))
 
 
+def find_chrones_file_name(pid):
+    chrones_file_names = glob.glob(f"*.{pid}.chrones.csv") + glob.glob(f"*.{pid}.chrones.blocks")
+    if len(chrones_file_names) == 1:
+        return chrones_file_names[0]
+    else:
+        return None
+
+
+def load_chrone_lines(chrones_file_name):
+    if chrones_file_name.endswith(".blocks"):
+        with open(chrones_file_name, "rb") as f:
+            yield from log_blocks.iter_lines(f)
+    else:
+        with open(chrones_file_name) as f:
+            yield from csv.reader(f)
+
+
 def load_chrone_events(pid):
-    chrones_file_names = glob.glob(f"*.{pid}.chrones.csv")
-    if len(chrones_file_names) != 1:
+    chrones_file_name = find_chrones_file_name(pid)
+    if chrones_file_name is None:
         return
 
-    with open(chrones_file_names[0]) as f:
-        for line in csv.reader(f):
-            yield make_chrone_event(line)
+    # Written by 'chrones-functions.cpp', to resolve the addresses of automatically instrumented functions
+    resolver = symbols.AddressResolver(chrones_file_name.rsplit(".", 1)[0] + ".maps")
+
+    lines = symbols.resolve_function_addresses(load_chrone_lines(chrones_file_name), resolver)
+    yield from apply_clock_offset(make_chrone_event(line) for line in lines)
+
+
+def load_chrone_thread_starts(pid):
+    chrones_file_name = find_chrones_file_name(pid)
+    if chrones_file_name is None:
+        return {}
+    else:
+        return get_thread_starts(load_chrone_lines(chrones_file_name))
+
+
+def apply_clock_offset(events):
+    # The 'ClockOffset' event, if any, is logged before all others
+    offset = 0
+    for event in events:
+        if event.__class__ == ClockOffset:
+            offset = event.offset
+        elif offset != 0:
+            event = dataclasses.replace(event, timestamp=event.timestamp + offset)
+        yield event
+
+
+def get_thread_starts(lines):
+    """
+    Return the timestamp of the first event of each thread, with the clock offset applied like by 'apply_clock_offset'.
+
+    Only the lines of 'ClockOffset' events are made into events: this is much cheaper than loading all events.
+    """
+    starts = {}
+    offset = 0
+    for line in lines:
+        if line[1] not in starts:
+            starts[line[1]] = int(line[2]) / 1e9 + (0 if line[3] == "clock_offset" else offset)
+        if line[3] == "clock_offset":
+            offset = make_chrone_event(line).offset
+    return starts
 
 
 def make_chrone_event(line):
@@ -186,11 +331,41 @@ def make_chrone_event(line):
             label=None if line[5] == "-" else line[5],
             index=None if line[6] == "-" else int(line[6]),
         )
+    elif line[3] == "clock_offset":
+        return ClockOffset(
+            process_id=process_id,
+            thread_id=thread_id,
+            timestamp=timestamp,
+            offset=int(line[4]) / 1e9,
+        )
+    elif line[3] == "os_thread":
+        return OsThread(
+            process_id=process_id,
+            thread_id=thread_id,
+            timestamp=timestamp,
+            os_thread_id=int(line[4]),
+        )
+    elif line[3] == "telemetry":
+        return Telemetry(
+            process_id=process_id,
+            thread_id=thread_id,
+            timestamp=timestamp,
+            events_count=int(line[4]),
+            bytes_count=int(line[5]),
+            flushes_count=int(line[6]),
+            flushes_duration=int(line[7]) / 1e9,
+            peak_backlog=int(line[8]),
+            contentions_count=int(line[9]),
+            contentions_duration=int(line[10]) / 1e9,
+            overwritten_events_count=int(line[11]),
+            worker_cpu_time=int(line[12]) / 1e9,
+        )
     elif line[3] == "sw_stop":
         return StopwatchStop(
             process_id=process_id,
             thread_id=thread_id,
             timestamp=timestamp,
+            work=float(line[4]) if len(line) > 4 else None,
         )
     elif line[3] == "sw_summary":
         return StopwatchSummary(
@@ -203,9 +378,44 @@ def make_chrone_event(line):
             average_duration=int(line[7]),
             duration_standard_deviation=int(line[8]),
             min_duration=int(line[9]),
-            median_duration=int(line[10]),
+            median_duration=int(line[10]) if line[10] != "" else None,
             max_duration=int(line[11]),
             total_duration=int(line[12]),
+            self_duration=int(line[13]) if len(line) > 13 else None,
+            index=int(line[14]) if len(line) > 14 and line[14] not in ("-", "+") else None,
+            other_indexes=len(line) > 14 and line[14] == "+",
+            percentile_99_duration=int(line[15]) if len(line) > 15 else None,
+            work_executions_count=int(line[16]) if len(line) > 16 else None,
+            total_work=float(line[17]) if len(line) > 16 else None,
+            average_throughput=float(line[18]) if len(line) > 16 else None,
+            min_throughput=float(line[19]) if len(line) > 16 else None,
+            median_throughput=float(line[20]) if len(line) > 16 else None,
+            percentile_1_throughput=float(line[21]) if len(line) > 16 else None,
+        )
+    elif line[3] == "sw_exemplar":
+        return StopwatchExemplar(
+            process_id=process_id,
+            thread_id=thread_id,
+            timestamp=timestamp,
+            function_name=line[4],
+            label=None if line[5] == "-" else line[5],
+            index=None if line[6] == "-" else int(line[6]),
+            duration=int(line[7]) / 1e9,
+        )
+    elif line[3] == "lock_summary":
+        return LockSummary(
+            process_id=process_id,
+            thread_id=thread_id,
+            timestamp=timestamp,
+            name=line[4],
+            mode=line[5],
+            acquisitions_count=int(line[6]),
+            contended_acquisitions_count=int(line[7]),
+            total_wait_duration=int(line[8]) / 1e9,
+            max_wait_duration=int(line[9]) / 1e9,
+            total_hold_duration=int(line[10]) / 1e9,
+            max_hold_duration=int(line[11]) / 1e9,
+            percentile_99_hold_duration=int(line[12]) / 1e9,
         )
     else:
         assert False
@@ -251,6 +461,70 @@ class MakeChroneEventTestCase(unittest.TestCase):
             ),
         )
 
+    def test_os_thread(self):
+        self.assertEqual(
+            make_chrone_event(["process_id", "thread_id", "375", "os_thread", "4242"]),
+            OsThread(
+                process_id="process_id",
+                thread_id="thread_id",
+                timestamp=375e-9,
+                os_thread_id=4242,
+            ),
+        )
+
+    def test_telemetry(self):
+        self.assertEqual(
+            make_chrone_event(["process_id", "thread_id", "375", "telemetry", "10", "1000", "2", "3000", "7", "1", "500", "0", "4000000"]),
+            Telemetry(
+                process_id="process_id",
+                thread_id="thread_id",
+                timestamp=375e-9,
+                events_count=10,
+                bytes_count=1000,
+                flushes_count=2,
+                flushes_duration=3e-6,
+                peak_backlog=7,
+                contentions_count=1,
+                contentions_duration=5e-7,
+                overwritten_events_count=0,
+                worker_cpu_time=4e-3,
+            ),
+        )
+
+    def test_clock_offset(self):
+        self.assertEqual(
+            make_chrone_event(["process_id", "thread_id", "375", "clock_offset", "-1500"]),
+            ClockOffset(
+                process_id="process_id",
+                thread_id="thread_id",
+                timestamp=375e-9,
+                offset=-1500e-9,
+            ),
+        )
+
+    def test_apply_clock_offset(self):
+        self.assertEqual(
+            list(apply_clock_offset([
+                ClockOffset(process_id="p", thread_id="t", timestamp=10, offset=-3),
+                StopwatchStop(process_id="p", thread_id="t", timestamp=12),
+            ])),
+            [
+                ClockOffset(process_id="p", thread_id="t", timestamp=10, offset=-3),
+                StopwatchStop(process_id="p", thread_id="t", timestamp=9),
+            ],
+        )
+
+    def test_get_thread_starts(self):
+        self.assertEqual(
+            get_thread_starts([
+                ["p", "t1", "10", "clock_offset", "-3"],
+                ["p", "t2", "12", "sw_stop"],
+                ["p", "t1", "11", "sw_stop"],
+                ["p", "t2", "14", "sw_stop"],
+            ]),
+            {"t1": 10e-9, "t2": 9e-9},
+        )
+
     def test_stopwatch_stop(self):
         self.assertEqual(
             make_chrone_event(["process_id", "thread_id", "375", "sw_stop"]),
@@ -261,6 +535,9 @@ class MakeChroneEventTestCase(unittest.TestCase):
             ),
         )
 
+    def test_stopwatch_stop_with_work(self):
+        self.assertEqual(make_chrone_event(["process_id", "thread_id", "375", "sw_stop", "1048576"]).work, 1048576)
+
     def test_stopwatch_summary(self):
         self.assertEqual(
             make_chrone_event(["process_id", "thread_id", "375", "sw_summary", "function_name", "label", 10, 9, 8, 7, 6, 5, 4]),
@@ -280,6 +557,95 @@ class MakeChroneEventTestCase(unittest.TestCase):
             )
         )
 
+    def test_stopwatch_summary_with_self_duration(self):
+        self.assertEqual(
+            make_chrone_event(["process_id", "thread_id", "375", "sw_summary", "function_name", "-", 10, 9, 8, 7, 6, 5, 4, 3]),
+            StopwatchSummary(
+                process_id="process_id",
+                thread_id="thread_id",
+                timestamp=375e-9,
+                function_name="function_name",
+                label=None,
+                executions_count=10,
+                average_duration=9,
+                duration_standard_deviation=8,
+                min_duration=7,
+                median_duration=6,
+                max_duration=5,
+                total_duration=4,
+                self_duration=3,
+            )
+        )
+
+    def test_stopwatch_summary_with_unknown_median(self):
+        self.assertEqual(
+            make_chrone_event(["process_id", "thread_id", "375", "sw_summary", "function_name", "-", 10, 9, 8, 7, "", 5, 4, 3]),
+            StopwatchSummary(
+                process_id="process_id",
+                thread_id="thread_id",
+                timestamp=375e-9,
+                function_name="function_name",
+                label=None,
+                executions_count=10,
+                average_duration=9,
+                duration_standard_deviation=8,
+                min_duration=7,
+                median_duration=None,
+                max_duration=5,
+                total_duration=4,
+                self_duration=3,
+            )
+        )
+
+    def test_stopwatch_exemplar(self):
+        self.assertEqual(
+            make_chrone_event(["process_id", "thread_id", "3000", "sw_exemplar", "function_name", "label", "3", "1000"]),
+            StopwatchExemplar(
+                process_id="process_id",
+                thread_id="thread_id",
+                timestamp=3e-6,
+                function_name="function_name",
+                label="label",
+                index=3,
+                duration=1e-6,
+            ),
+        )
+        event = make_chrone_event(["process_id", "thread_id", "3000", "sw_exemplar", "function_name", "-", "-", "1000"])
+        self.assertIsNone(event.label)
+        self.assertIsNone(event.index)
+        self.assertAlmostEqual(event.start_timestamp, 2e-6)
+
+    def test_stopwatch_summary_with_work(self):
+        event = make_chrone_event([
+            "process_id", "thread_id", "375", "sw_summary", "function_name", "-", 10, 9, 8, 7, 6, 5, 4, 3, "-", 2,
+            "3", "300", "4285714176", "2500000000", "5000000000", "2500000000",
+        ])
+        self.assertEqual(event.work_executions_count, 3)
+        self.assertEqual(event.total_work, 300)
+        self.assertEqual(event.average_throughput, 4285714176)
+        self.assertEqual(event.min_throughput, 2.5e9)
+        self.assertEqual(event.median_throughput, 5e9)
+        self.assertEqual(event.percentile_1_throughput, 2.5e9)
+
+    def test_stopwatch_summary_for_index(self):
+        event = make_chrone_event(["process_id", "thread_id", "375", "sw_summary", "function_name", "-", 10, 9, 8, 7, 6, 5, 4, 3, "12", 2])
+        self.assertEqual(event.percentile_99_duration, 2)
+        self.assertEqual(event.index, 12)
+        self.assertFalse(event.other_indexes)
+        self.assertFalse(event.for_all_indexes)
+
+    def test_stopwatch_summary_for_other_indexes(self):
+        event = make_chrone_event(["process_id", "thread_id", "375", "sw_summary", "function_name", "-", 10, 9, 8, 7, 6, 5, 4, 3, "+"])
+        self.assertIsNone(event.index)
+        self.assertTrue(event.other_indexes)
+        self.assertFalse(event.for_all_indexes)
+
+    def test_stopwatch_summary_for_all_indexes(self):
+        event = make_chrone_event(["process_id", "thread_id", "375", "sw_summary", "function_name", "-", 10, 9, 8, 7, 6, 5, 4, 3, "-"])
+        self.assertIsNone(event.index)
+        self.assertFalse(event.other_indexes)
+        self.assertTrue(event.for_all_indexes)
+
     def test_stopwatch_summary_no_label(self):
         self.assertEqual(
             make_chrone_event(["process_id", "thread_id", "375", "sw_summary", "function_name", "-", 10, 9, 8, 7, 6, 5, 4]),
@@ -299,3 +665,21 @@ class MakeChroneEventTestCase(unittest.TestCase):
             )
         )
 
+    def test_lock_summary(self):
+        self.assertEqual(
+            make_chrone_event(["process_id", "thread_id", "375", "lock_summary", "name", "shared", "10", "2", "3000", "2000", "50000", "9000", "8000"]),
+            LockSummary(
+                process_id="process_id",
+                thread_id="thread_id",
+                timestamp=375e-9,
+                name="name",
+                mode="shared",
+                acquisitions_count=10,
+                contended_acquisitions_count=2,
+                total_wait_duration=3e-6,
+                max_wait_duration=2e-6,
+                total_hold_duration=50e-6,
+                max_hold_duration=9e-6,
+                percentile_99_hold_duration=8e-6,
+            )
+        )
@@ -13,11 +13,14 @@ import time
 
 import psutil
 
+from .hotspots import LiveHotspots
+from .proc_sampler import ProcSampler, ProcessSample, MemoryInfo, InputOutputCounters, ContextSwitches, ThreadsSampler, ThreadSample
 from .result import (
     RunResults, RunSettings,
     System, SystemInstantMetrics,
     MainProcess, MainProcessGlobalMetrics,
     Process, ProcessInstantMetrics, MemoryInstantMetrics, InputOutputoInstantMetrics, ContextSwitchInstantMetrics,
+    ThreadInstantMetrics,
 )
 
 
@@ -28,17 +31,17 @@ class InProgressProcessInstantMetrics:
     cpu_percent: float
     user_time: float
     system_time: float
-    memory: psutil._pslinux.pfullmem
+    memory: MemoryInfo
     open_files: int
-    io: psutil._pslinux.pio
-    context_switches: psutil._common.pctxsw
+    io: InputOutputCounters
+    context_switches: ContextSwitches
     gpu_percent: Optional[float]
     gpu_memory: Optional[float]
+    threads_metrics: Optional[List[ThreadSample]]
 
 
 @dataclasses.dataclass
 class InProgressProcess:
-    psutil_process: psutil.Process
     pid: int
     command: List[str]
     started_between_timestamps: Tuple[float, float]
@@ -47,12 +50,68 @@ class InProgressProcess:
     instant_metrics: List[InProgressProcessInstantMetrics]
 
 
+class PsutilSampler:
+    """Sample processes using psutil. Same interface as 'ProcSampler'"""
+
+    def __init__(self):
+        self.__processes = {}
+
+    def start(self, pid) -> List[str]:
+        try:
+            process = psutil.Process(pid)
+            process.cpu_percent()  # Ignore first, meaningless 0.0 returned, as per https://psutil.readthedocs.io/en/latest/#psutil.Process.cpu_percent
+            command = process.cmdline()
+        except psutil.NoSuchProcess:
+            raise ProcessLookupError(pid)
+        self.__processes[pid] = process
+        return command
+
+    def stop(self, pid):
+        del self.__processes[pid]
+
+    def sample(self, pid) -> ProcessSample:
+        process = self.__processes[pid]
+        try:
+            with process.oneshot():
+                cpu_times = process.cpu_times()
+                return ProcessSample(
+                    threads=process.num_threads(),
+                    cpu_percent=process.cpu_percent(),
+                    user_time=cpu_times.user,
+                    system_time=cpu_times.system,
+                    memory=process.memory_full_info(),
+                    open_files=len(process.open_files()),
+                    io=process.io_counters(),
+                    context_switches=process.num_ctx_switches(),
+                )
+        except psutil.NoSuchProcess:
+            raise ProcessLookupError(pid)
+        except psutil.AccessDenied:
+            raise PermissionError(pid)
+
+    def children(self, pid) -> List[int]:
+        try:
+            return [child.pid for child in self.__processes[pid].children()]
+        except psutil.NoSuchProcess:
+            raise ProcessLookupError(pid)
+
+
+samplers = {
+    "psutil": PsutilSampler,
+    "proc": ProcSampler,
+}
+
+
 class Runner:
-    def __init__(self, *, logs_directory, monitor_gpu, monitoring_interval, allowed_missing_samples):
+    def __init__(self, *, logs_directory, monitor_gpu, monitoring_interval, allowed_missing_samples, live_hotspots=0, live_hotspots_interval=10, monitoring_backend="psutil", monitor_threads=False):
         self.__monitoring_interval = monitoring_interval
         self.__logs_directory = logs_directory
         self.__monitor_gpu = monitor_gpu
         self.__allowed_missing_samples = allowed_missing_samples
+        self.__live_hotspots = live_hotspots
+        self.__live_hotspots_interval = live_hotspots_interval
+        self.__monitoring_backend = monitoring_backend
+        self.__monitor_threads = monitor_threads
 
     def run(self, command):
         return self.__Run(
@@ -61,15 +120,26 @@ class Runner:
             logs_directory=self.__logs_directory,
             monitor_gpu=self.__monitor_gpu,
             allowed_missing_samples=self.__allowed_missing_samples,
+            live_hotspots=self.__live_hotspots,
+            live_hotspots_interval=self.__live_hotspots_interval,
+            monitoring_backend=self.__monitoring_backend,
+            monitor_threads=self.__monitor_threads,
         )()
 
     class __Run:
-        def __init__(self, command, *, monitoring_interval, logs_directory, monitor_gpu, allowed_missing_samples):
+        def __init__(self, command, *, monitoring_interval, logs_directory, monitor_gpu, allowed_missing_samples, live_hotspots, live_hotspots_interval, monitoring_backend, monitor_threads):
             self.__command = command
             self.__monitoring_interval = monitoring_interval
             self.__logs_directory = logs_directory
             self.__monitor_gpu = monitor_gpu
             self.__allowed_missing_samples = allowed_missing_samples
+            if live_hotspots > 0:
+                self.__live_hotspots = LiveHotspots(logs_directory, top=live_hotspots)
+            else:
+                self.__live_hotspots = None
+            self.__live_hotspots_interval = live_hotspots_interval
+            self.__sampler = samplers[monitoring_backend]()
+            self.__threads_sampler = ThreadsSampler() if monitor_threads else None
 
             self.__usage_before = resource.getrusage(resource.RUSAGE_CHILDREN)
             self.__monitored_processes = {}
@@ -80,7 +150,7 @@ class Runner:
             env = dict(os.environ)
             os.makedirs(self.__logs_directory, exist_ok=True)
             env["CHRONES_LOGS_DIRECTORY"] = os.path.abspath(self.__logs_directory)
-            main_process = psutil.Popen(
+            popen = subprocess.Popen(
                 self.__command,
                 env=env,
             )
@@ -88,10 +158,11 @@ class Runner:
             self.__previous_timestamp = self.__timestamp
             spawn_time = self.__timestamp
 
-            main_process = self.__start_monitoring_process(main_process)
+            main_process = self.__start_monitoring_process(popen.pid, None)
             iteration = 0
+            live_hotspots_timestamp = spawn_time
 
-            while main_process.psutil_process.returncode is None:
+            while popen.returncode is None:
                 missing_samples = 0
                 while True:
                     iteration += 1
@@ -102,7 +173,7 @@ class Runner:
                     else:
                         missing_samples += 1
                 try:
-                    main_process.psutil_process.communicate(timeout=timeout)
+                    popen.communicate(timeout=timeout)
                 except subprocess.TimeoutExpired:
                     self.__previous_timestamp = self.__timestamp
                     self.__timestamp = time.time()
@@ -110,6 +181,11 @@ class Runner:
                     if missing_samples > self.__allowed_missing_samples:
                         logging.warn(f"Monitoring is slow. {missing_samples} samples will be missing just before t={self.__timestamp:.3f}s.")
                     self.__run_monitoring_iteration()
+                    if self.__live_hotspots is not None:
+                        self.__live_hotspots.update(self.__monitored_processes.keys())
+                        if self.__timestamp >= live_hotspots_timestamp + self.__live_hotspots_interval:
+                            live_hotspots_timestamp = self.__timestamp
+                            self.__live_hotspots.print(self.__timestamp, spawn_time)
                 else:
                     self.__previous_timestamp = self.__timestamp
                     self.__timestamp = time.time()
@@ -117,7 +193,7 @@ class Runner:
                     self.__terminate()
 
             return RunResults(
-                run_settings=RunSettings(gpu_monitored=self.__monitor_gpu),
+                run_settings=RunSettings(gpu_monitored=self.__monitor_gpu, threads_monitored=self.__threads_sampler is not None),
                 system=System(instant_metrics=[
                     SystemInstantMetrics(
                         timestamp=m.timestamp,
@@ -126,24 +202,21 @@ class Runner:
                     )
                     for m in self.__system_instant_metrics
                 ]),
-                main_process=self.__return_main_process(main_process, main_process.psutil_process.returncode),
+                main_process=self.__return_main_process(main_process, popen.returncode),
             )
 
-        def __start_monitoring_process(self, psutil_process):
-            psutil_process.cpu_percent()  # Ignore first, meaningless 0.0 returned, as per https://psutil.readthedocs.io/en/latest/#psutil.Process.cpu_percent
+        def __start_monitoring_process(self, pid, parent):
             child = InProgressProcess(
-                psutil_process=psutil_process,
-                pid=psutil_process.pid,
-                command=psutil_process.cmdline(),
+                pid=pid,
+                command=self.__sampler.start(pid),
                 started_between_timestamps=(self.__previous_timestamp, self.__timestamp),
                 terminated_between_timestamps=None,
                 children=[],  # We'll detect children in the next iteration
                 instant_metrics=[],  # We'll gather the first instant metrics in the next iteration
             )
-            self.__monitored_processes[psutil_process.pid] = child
-            parent = psutil_process.ppid()
-            if parent in self.__monitored_processes:
-                self.__monitored_processes[parent].children.append(child)
+            self.__monitored_processes[pid] = child
+            if parent is not None:
+                parent.children.append(child)
             return child
 
         def __run_monitoring_iteration(self):
@@ -164,7 +237,7 @@ class Runner:
                 try:
                     self.__gather_instant_metrics(process)
                     self.__gather_children(process)
-                except psutil.NoSuchProcess:
+                except ProcessLookupError:
                     self.__stop_monitoring_process(process)
 
             if self.__monitor_gpu:
@@ -218,43 +291,48 @@ class Runner:
 
         def __gather_instant_metrics(self, process):
             try:
-                with process.psutil_process.oneshot():
-                    cpu_times = process.psutil_process.cpu_times()
-                    process.instant_metrics.append(InProgressProcessInstantMetrics(
-                        timestamp=self.__timestamp,
-                        threads=process.psutil_process.num_threads(),
-                        cpu_percent=process.psutil_process.cpu_percent(),
-                        user_time=cpu_times.user,
-                        system_time=cpu_times.system,
-                        memory=process.psutil_process.memory_full_info(),
-                        open_files=len(process.psutil_process.open_files()),
-                        io=process.psutil_process.io_counters(),
-                        context_switches=process.psutil_process.num_ctx_switches(),
-                        gpu_percent=None,
-                        gpu_memory=None,
-                    ))
-            except psutil.AccessDenied:
-                logging.warn(f"Exception 'psutil.AccessDenied' occurred. Instant metrics for {process.command} will be missing at t={self.__timestamp}s.")
+                sample = self.__sampler.sample(process.pid)
+                threads_metrics = None if self.__threads_sampler is None else self.__threads_sampler.sample(process.pid)
+            except PermissionError:
+                logging.warn(f"Permission denied. Instant metrics for {process.command} will be missing at t={self.__timestamp}s.")
+            else:
+                process.instant_metrics.append(InProgressProcessInstantMetrics(
+                    timestamp=self.__timestamp,
+                    **sample._asdict(),
+                    gpu_percent=None,
+                    gpu_memory=None,
+                    threads_metrics=threads_metrics,
+                ))
 
         def __gather_children(self, process):
-            for child in process.psutil_process.children():
-                if child.pid not in self.__monitored_processes:
-                    self.__start_monitoring_process(child)
+            for child in self.__sampler.children(process.pid):
+                if child not in self.__monitored_processes:
+                    try:
+                        self.__start_monitoring_process(child, process)
+                    except ProcessLookupError:
+                        pass  # This child has already terminated
 
         def __stop_monitoring_process(self, process):
             process.terminated_between_timestamps = (self.__previous_timestamp, self.__timestamp)
             del self.__monitored_processes[process.pid]
+            self.__stop_sampling(process)
 
         def __terminate(self):
             self.__usage_after = resource.getrusage(resource.RUSAGE_CHILDREN)
             for process in self.__monitored_processes.values():
                 if process.terminated_between_timestamps is None:
                     process.terminated_between_timestamps = (self.__previous_timestamp, self.__timestamp)
+                self.__stop_sampling(process)
+
+        def __stop_sampling(self, process):
+            self.__sampler.stop(process.pid)
+            if self.__threads_sampler is not None:
+                self.__threads_sampler.stop(process.pid)
 
         def __return_main_process(self, process, exit_code):
             return MainProcess(
                 command_list=self.__command,
-                pid=process.psutil_process.pid,
+                pid=process.pid,
                 started_between_timestamps=process.started_between_timestamps,
                 terminated_between_timestamps=process.terminated_between_timestamps,
                 instant_metrics=self.__return_instant_metrics(process),
@@ -291,6 +369,17 @@ class Runner:
                     context_switches=ContextSwitchInstantMetrics(voluntary=m.context_switches.voluntary, involuntary=m.context_switches.involuntary),
                     gpu_percent=m.gpu_percent,
                     gpu_memory=m.gpu_memory,
+                    threads_metrics=None if m.threads_metrics is None else [
+                        ThreadInstantMetrics(
+                            os_thread_id=t.os_thread_id,
+                            state=t.state,
+                            user_time=t.user_time,
+                            system_time=t.system_time,
+                            last_cpu=t.last_cpu,
+                            context_switches=ContextSwitchInstantMetrics(voluntary=t.context_switches.voluntary, involuntary=t.context_switches.involuntary),
+                        )
+                        for t in m.threads_metrics
+                    ],
                 )
                 for m in process.instant_metrics
             ]
@@ -298,7 +387,7 @@ class Runner:
         def __return_process(self, process: InProgressProcess):
             return Process(
                 command_list=process.command,
-                pid=process.psutil_process.pid,
+                pid=process.pid,
                 started_between_timestamps=process.started_between_timestamps,
                 terminated_between_timestamps=process.terminated_between_timestamps,
                 instant_metrics=self.__return_instant_metrics(process),
@@ -0,0 +1,173 @@
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+# Resolution of the function addresses logged by 'chrones-functions.cpp' ('fn_start' and 'fn_summary' events),
+# using the snapshot of '/proc/self/maps' it saves and the symbol tables of the mapped ELF files.
+
+from __future__ import annotations
+
+import bisect
+import ctypes
+import dataclasses
+import os
+import shutil
+import struct
+import subprocess
+import tempfile
+import unittest
+
+
+def resolve_function_addresses(lines, resolver):
+    """Rewrite 'fn_start' and 'fn_summary' lines (already split in fields) into 'sw_start' and 'sw_summary' lines"""
+    for line in lines:
+        if line[3] in ("fn_start", "fn_summary"):
+            line = line[:3] + [line[3].replace("fn_", "sw_"), resolver.resolve(line[4])] + line[5:]
+        yield line
+
+
+class AddressResolver:
+    def __init__(self, maps_file_name):
+        self.__maps_file_name = maps_file_name
+        self.__mappings = None  # Loaded on first use: most logs don't contain any address
+        self.__symbol_tables = {}
+        self.__names = {}
+
+    def resolve(self, address):
+        name = self.__names.get(address)
+        if name is None:
+            name = self.__resolve(int(address, 16)) or address
+            self.__names[address] = name
+        return name
+
+    def __resolve(self, address):
+        if self.__mappings is None:
+            self.__mappings = []
+            if os.path.isfile(self.__maps_file_name):
+                with open(self.__maps_file_name) as f:
+                    self.__mappings = [mapping for mapping in (Mapping.parse(line) for line in f) if mapping is not None]
+        for mapping in self.__mappings:
+            if mapping.start <= address < mapping.end:
+                symbol_table = self.__symbol_tables.get(mapping.path)
+                if symbol_table is None:
+                    symbol_table = SymbolTable.load(mapping.path)
+                    self.__symbol_tables[mapping.path] = symbol_table
+                return symbol_table.find(address - mapping.start + mapping.offset)
+        return None
+
+
+@dataclasses.dataclass(frozen=True)
+class Mapping:
+    start: int
+    end: int
+    offset: int
+    path: str
+
+    @staticmethod
+    def parse(line):
+        # "55941b54c000-55941b567000 r-xp 00041000 fe:00 13533252   /tmp/program"
+        parts = line.split(maxsplit=5)
+        if len(parts) < 6 or not parts[5].startswith("/"):
+            return None  # Anonymous mapping, [stack], [vdso], etc.
+        (start, end) = parts[0].split("-")
+        return Mapping(start=int(start, 16), end=int(end, 16), offset=int(parts[2], 16), path=parts[5].rstrip("\n"))
+
+
+class SymbolTable:
+    """The functions of an ELF64 file, searchable by file offset"""
+
+    def __init__(self, segments, symbols):
+        self.__segments = segments  # (file offset, file size, virtual address)
+        self.__symbols = sorted(symbols)  # (virtual address, size, name)
+        self.__addresses = [address for (address, _, _) in self.__symbols]
+
+    @staticmethod
+    def load(path):
+        try:
+            with open(path, "rb") as f:
+                data = f.read()
+        except OSError:
+            return SymbolTable([], [])
+        if data[:4] != b"\x7fELF" or data[4] != 2 or data[5] != 1:
+            return SymbolTable([], [])  # Not a little-endian ELF64 file
+
+        (e_phoff, e_shoff) = struct.unpack_from("<QQ", data, 0x20)
+        (e_phentsize, e_phnum, e_shentsize, e_shnum) = struct.unpack_from("<HHHH", data, 0x36)
+
+        segments = []
+        for i in range(e_phnum):
+            (p_type, _, p_offset, p_vaddr, _, p_filesz) = struct.unpack_from("<IIQQQQ", data, e_phoff + i * e_phentsize)
+            if p_type == 1:  # PT_LOAD
+                segments.append((p_offset, p_filesz, p_vaddr))
+
+        sections = [
+            struct.unpack_from("<IIQQQQIIQQ", data, e_shoff + i * e_shentsize)
+            for i in range(e_shnum)
+        ]
+        symbols = []
+        for (_, sh_type, _, _, sh_offset, sh_size, sh_link, _, _, sh_entsize) in sections:
+            if sh_type not in (2, 11):  # SHT_SYMTAB, SHT_DYNSYM
+                continue
+            strings_offset = sections[sh_link][4]
+            for i in range(sh_size // sh_entsize):
+                (st_name, st_info, _, st_shndx, st_value, st_size) = struct.unpack_from("<IBBHQQ", data, sh_offset + i * sh_entsize)
+                if st_info & 0xF == 2 and st_shndx != 0 and st_value != 0:  # STT_FUNC, defined
+                    end = data.index(b"\0", strings_offset + st_name)
+                    symbols.append((st_value, st_size, data[strings_offset + st_name:end].decode(errors="replace")))
+
+        return SymbolTable(segments, demangle(symbols))
+
+    def find(self, file_offset):
+        for (p_offset, p_filesz, p_vaddr) in self.__segments:
+            if p_offset <= file_offset < p_offset + p_filesz:
+                address = file_offset - p_offset + p_vaddr
+                i = bisect.bisect_right(self.__addresses, address) - 1
+                if i >= 0:
+                    (start, size, name) = self.__symbols[i]
+                    if address < start + max(size, 1):
+                        return name
+                return None
+        return None
+
+
+def demangle(symbols):
+    c_plus_plus_filt = shutil.which("c++filt")
+    if c_plus_plus_filt is None or not symbols:
+        return symbols
+    names = subprocess.run(
+        [c_plus_plus_filt],
+        input="\n".join(name for (_, _, name) in symbols),
+        stdout=subprocess.PIPE, universal_newlines=True, check=True,
+    ).stdout.splitlines()
+    if len(names) != len(symbols):
+        return symbols
+    return [(address, size, name) for ((address, size, _), name) in zip(symbols, names)]
+
+
+class ResolveFunctionAddressesTestCase(unittest.TestCase):
+    def test_libc_function(self):
+        address = ctypes.cast(ctypes.CDLL(None).getpid, ctypes.c_void_p).value
+        with tempfile.TemporaryDirectory() as directory:
+            maps_file_name = os.path.join(directory, "program.42.chrones.maps")
+            with open("/proc/self/maps") as maps, open(maps_file_name, "w") as f:
+                f.write(maps.read())
+            lines = list(resolve_function_addresses(
+                [
+                    ["42", "0", "10", "fn_start", hex(address), "-", "-"],
+                    ["42", "0", "20", "sw_stop"],
+                    ["42", "0", "30", "fn_summary", hex(address), "omp for", "1", "10"],
+                    ["42", "0", "40", "fn_start", "0x10", "-", "-"],
+                ],
+                AddressResolver(maps_file_name),
+            ))
+        self.assertIn(lines[0][4], ("getpid", "__getpid"))
+        self.assertEqual(lines[0][3:4] + lines[0][5:], ["sw_start", "-", "-"])
+        self.assertEqual(lines[1], ["42", "0", "20", "sw_stop"])
+        self.assertEqual(lines[2][3:5], ["sw_summary", lines[0][4]])
+        self.assertEqual(lines[2][5:], ["omp for", "1", "10"])
+        self.assertEqual(lines[3][4], "0x10")
+
+    def test_no_maps(self):
+        self.assertEqual(
+            list(resolve_function_addresses([["42", "0", "10", "fn_start", "0x10", "-", "-"]], AddressResolver("/nonexistent"))),
+            [["42", "0", "10", "sw_start", "0x10", "-", "-"]],
+        )
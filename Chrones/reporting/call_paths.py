@@ -0,0 +1,195 @@
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+from __future__ import annotations
+
+from typing import Dict, List, Tuple
+import dataclasses
+import os
+import tempfile
+import unittest
+
+from ..monitoring.result import ClockOffset, LockSummary, OsThread, StopwatchExemplar, StopwatchStart, StopwatchStop, StopwatchSummary, Telemetry
+from .summaries import make_stopwatch_start, make_stopwatch_stop
+
+
+def write_call_paths(call_paths, output_file):
+    with open(output_file, "w") as f:
+        f.write(f"{'Inclusive (s)':>14} {'Exclusive (s)':>14} {'Count':>10}  Call path\n")
+        for call_path in sort_call_paths(call_paths):
+            f.write(
+                f"{call_path.inclusive_duration:14.6f} {call_path.exclusive_duration:14.6f} {call_path.executions_count:10}"
+                f"  {'  ' * (len(call_path.path) - 1)}{call_path.path[-1]}\n"
+            )
+
+
+def write_folded_stacks(call_paths, output_file):
+    # Format consumed by flame graph tools like https://github.com/brendangregg/FlameGraph: "a;b;c <count>".
+    # Our count is the exclusive time in nanoseconds.
+    with open(output_file, "w") as f:
+        for call_path in call_paths:
+            exclusive_duration = round(call_path.exclusive_duration * 1e9)
+            if exclusive_duration > 0:
+                f.write(f"{';'.join(name.replace(';', ',') for name in call_path.path)} {exclusive_duration}\n")
+
+
+def sort_call_paths(call_paths):
+    # Depth-first, siblings by decreasing inclusive time, so that the output reads like a tree
+    children = {}
+    for call_path in call_paths:
+        children.setdefault(call_path.path[:-1], []).append(call_path)
+
+    def walk(path):
+        for call_path in sorted(children.get(path, []), key=lambda c: -c.inclusive_duration):
+            yield call_path
+            yield from walk(call_path.path)
+
+    return list(walk(()))
+
+
+@dataclasses.dataclass
+class CallPath:
+    path: Tuple[str, ...]
+    executions_count: int
+    inclusive_duration: float
+    exclusive_duration: float
+
+
+class CallPathsExtractor:
+    """
+    Build the call tree from the nested stopwatches of each thread, and aggregate it by call path.
+
+    Call paths are merged across threads and processes.
+    Light stopwatches only report a summary when they are destroyed, without their call path:
+    they appear as roots, with the self time they report as exclusive time.
+    """
+
+    @dataclasses.dataclass
+    class Frame:
+        start_event: StopwatchStart
+        path: Tuple[str, ...]
+        children_duration: float
+
+    def __init__(self):
+        self.__stacks: Dict[Tuple[str, str], List[CallPathsExtractor.Frame]] = {}
+        self.__call_paths: Dict[Tuple[str, ...], CallPath] = {}
+
+    def process(self, event):
+        stack = self.__stacks.setdefault((event.process_id, event.thread_id), [])
+        if event.__class__ == StopwatchStart:
+            parent_path = stack[-1].path if stack else ()
+            stack.append(CallPathsExtractor.Frame(event, parent_path + (make_name(event),), 0))
+        elif event.__class__ == StopwatchStop:
+            frame = stack.pop()
+            duration = event.timestamp - frame.start_event.timestamp
+            assert duration >= 0
+            self.__add(frame.path, 1, duration, duration - frame.children_duration)
+            if stack:
+                stack[-1].children_duration += duration
+        elif event.__class__ == StopwatchSummary:
+            if not event.for_all_indexes:
+                return  # Already counted in the summary for all indexes
+            self_duration = event.total_duration if event.self_duration is None else event.self_duration
+            self.__add((make_name(event),), event.executions_count, event.total_duration / 1e9, self_duration / 1e9)
+        elif event.__class__ in (ClockOffset, OsThread, Telemetry, LockSummary, StopwatchExemplar):
+            pass
+        else:
+            assert False
+
+    def __add(self, path, executions_count, inclusive_duration, exclusive_duration):
+        call_path = self.__call_paths.setdefault(path, CallPath(path, 0, 0, 0))
+        call_path.executions_count += executions_count
+        call_path.inclusive_duration += inclusive_duration
+        call_path.exclusive_duration += exclusive_duration
+
+    @property
+    def result(self):
+        assert all(len(stack) == 0 for stack in self.__stacks.values())
+        return list(self.__call_paths.values())
+
+
+def make_name(event):
+    return event.function_name if event.label is None else f"{event.function_name} - {event.label}"
+
+
+class CallPathsExtractorTestCase(unittest.TestCase):
+    def extract_call_paths(self, events):
+        extractor = CallPathsExtractor()
+        for event in events:
+            extractor.process(event)
+        return sort_call_paths(extractor.result)
+
+    def test_empty(self):
+        self.assertEqual(self.extract_call_paths([]), [])
+
+    def test_same_function_in_different_paths(self):
+        self.assertEqual(
+            self.extract_call_paths([
+                make_stopwatch_start("p", "t", 0, "main"),
+                make_stopwatch_start("p", "t", 1, "f"),
+                make_stopwatch_start("p", "t", 2, "h"),
+                make_stopwatch_stop("p", "t", 3),
+                make_stopwatch_start("p", "t", 4, "h"),
+                make_stopwatch_stop("p", "t", 6),
+                make_stopwatch_stop("p", "t", 7),
+                make_stopwatch_start("p", "t", 8, "g", "label"),
+                make_stopwatch_start("p", "t", 9, "h"),
+                make_stopwatch_stop("p", "t", 13),
+                make_stopwatch_stop("p", "t", 14),
+                make_stopwatch_stop("p", "t", 20),
+            ]),
+            [
+                CallPath(("main",), 1, 20, 8),
+                CallPath(("main", "f"), 1, 6, 3),
+                CallPath(("main", "f", "h"), 2, 3, 3),
+                CallPath(("main", "g - label"), 1, 6, 2),
+                CallPath(("main", "g - label", "h"), 1, 4, 4),
+            ],
+        )
+
+    def test_threads_are_merged(self):
+        self.assertEqual(
+            self.extract_call_paths([
+                make_stopwatch_start("p", "t_a", 0, "f"),
+                make_stopwatch_start("p", "t_b", 1, "f"),
+                make_stopwatch_start("p", "t_b", 2, "g"),
+                make_stopwatch_stop("p", "t_a", 3),
+                make_stopwatch_stop("p", "t_b", 4),
+                make_stopwatch_stop("p", "t_b", 5),
+            ]),
+            [
+                CallPath(("f",), 2, 7, 5),
+                CallPath(("f", "g"), 1, 2, 2),
+            ],
+        )
+
+    def test_summary(self):
+        self.assertEqual(
+            self.extract_call_paths([
+                StopwatchSummary(
+                    process_id="p", thread_id="t", timestamp=42, function_name="f", label=None,
+                    executions_count=3, average_duration=2_000_000_000, duration_standard_deviation=0,
+                    min_duration=2_000_000_000, median_duration=2_000_000_000, max_duration=2_000_000_000,
+                    total_duration=6_000_000_000,
+                ),
+            ]),
+            [
+                CallPath(("f",), 3, 6, 6),
+            ],
+        )
+
+
+class WriteFoldedStacksTestCase(unittest.TestCase):
+    def test_write(self):
+        with tempfile.TemporaryDirectory() as directory:
+            output_file = os.path.join(directory, "stacks.folded")
+            write_folded_stacks(
+                [
+                    CallPath(("main",), 1, 20, 8),
+                    CallPath(("main", "f;g"), 1, 12, 12),
+                    CallPath(("main", "h"), 1, 0, 0),
+                ],
+                output_file,
+            )
+            with open(output_file) as f:
+                self.assertEqual(f.read(), "main 8000000000\nmain;f,g 12000000000\n")
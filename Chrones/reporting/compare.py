@@ -0,0 +1,314 @@
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+from __future__ import annotations
+
+from typing import Dict, List, Optional, Tuple
+import dataclasses
+import io
+import math
+import os
+import statistics
+import unittest
+
+from ..monitoring import result as monitoring_result
+from .summaries import MultiThreadedDurationsExtractor, Summary, summarize
+from .timeline import iter_timeline
+
+
+@dataclasses.dataclass
+class RunStopwatches:
+    # By function, label and whether the stopwatch is light: light and heavy stopwatches with the same name are not merged
+    summaries: Dict[Tuple[str, Optional[str], bool], Summary]
+    # Per-invocation durations of heavy stopwatches, by function and label
+    durations: Dict[Tuple[str, Optional[str]], List[float]]
+
+
+def load_run_stopwatches(logs_dir):
+    # Results and logs are loaded relative to the current directory
+    previous_directory = os.getcwd()
+    os.chdir(logs_dir)
+    try:
+        results = monitoring_result.RunResults.load()
+        # Light stopwatches only log summaries
+        extractors = {False: MultiThreadedDurationsExtractor(), True: MultiThreadedDurationsExtractor()}
+        for event in iter_timeline(results.main_process):
+            extractors[isinstance(event, monitoring_result.StopwatchSummary)].process(event)
+    finally:
+        os.chdir(previous_directory)
+
+    (durations, _) = extractors[False].result
+    summaries = {}
+    for (light, extractor) in extractors.items():
+        for summary in summarize(extractor):
+            summaries[(summary.function_name, summary.label, light)] = summary
+    return RunStopwatches(summaries, durations)
+
+
+@dataclasses.dataclass
+class Thresholds:
+    """Maximum relative increases (0.1 for +10%) before a stopwatch is considered a regression. None to ignore."""
+    total: Optional[float] = None
+    mean: Optional[float] = None
+    median: Optional[float] = None
+    percentile_99: Optional[float] = None
+    # Increases of the mean, median and P99 of stopwatches whose durations are known are regressions
+    # only if they are significant. The total is a single value per run: its increases are always regressions.
+    significance: float = 0.05
+
+
+@dataclasses.dataclass
+class Comparison:
+    function_name: str
+    label: Optional[str]
+    light: bool
+    executions_count_a: int
+    executions_count_b: int
+    # Relative changes from A to B (0.1 for +10%), None when unknown
+    total_change: Optional[float]
+    mean_change: Optional[float]
+    median_change: Optional[float]
+    percentile_99_change: Optional[float]
+    # Of a two-sided Mann-Whitney U test on the durations of each invocation, None when they are not known
+    p_value: Optional[float]
+    regressions: List[str]
+
+    @property
+    def name(self):
+        name = self.function_name if self.label is None else f"{self.function_name} - {self.label}"
+        return f"{name} (light)" if self.light else name
+
+
+def compare_runs(a: RunStopwatches, b: RunStopwatches, thresholds: Thresholds):
+    """Compare the stopwatches present in both runs, matched by function, label and kind"""
+    comparisons = []
+    for key in sorted(a.summaries.keys() & b.summaries.keys(), key=sort_key):
+        summary_a = a.summaries[key]
+        summary_b = b.summaries[key]
+        (function_name, label, light) = key
+        durations_a = [] if light else a.durations.get((function_name, label), [])
+        durations_b = [] if light else b.durations.get((function_name, label), [])
+
+        if len(durations_a) >= 2 and len(durations_b) >= 2:
+            p_value = mann_whitney_u_test(durations_a, durations_b)
+            percentile_99_change = relative_change(percentile_99(durations_a), percentile_99(durations_b))
+        else:
+            p_value = None
+            # Logged by light stopwatches, in their summaries
+            percentile_99_change = relative_change(summary_a.percentile_99_duration, summary_b.percentile_99_duration)
+
+        changes = dict(
+            total=relative_change(summary_a.total_duration, summary_b.total_duration),
+            mean=relative_change(mean(summary_a), mean(summary_b)),
+            median=relative_change(summary_a.median_duration, summary_b.median_duration),
+            percentile_99=percentile_99_change,
+        )
+
+        significant = p_value is None or p_value < thresholds.significance
+        regressions = [
+            name
+            for (name, change) in changes.items()
+            if (significant or name == "total")
+            and change is not None and getattr(thresholds, name) is not None and change > getattr(thresholds, name)
+        ]
+
+        comparisons.append(Comparison(
+            function_name=function_name,
+            label=label,
+            light=light,
+            executions_count_a=summary_a.executions_count,
+            executions_count_b=summary_b.executions_count,
+            total_change=changes["total"],
+            mean_change=changes["mean"],
+            median_change=changes["median"],
+            percentile_99_change=changes["percentile_99"],
+            p_value=p_value,
+            regressions=regressions,
+        ))
+    return comparisons
+
+
+def sort_key(key):
+    (function_name, label, light) = key
+    return (function_name, label or "", light)
+
+
+def mean(summary):
+    if summary.average_duration is not None:
+        return summary.average_duration
+    else:
+        return summary.total_duration / summary.executions_count
+
+
+def percentile_99(durations):
+    return statistics.quantiles(durations, n=100)[98]
+
+
+def relative_change(a, b):
+    if a is None or b is None or a == 0:
+        return None
+    return (b - a) / a
+
+
+def mann_whitney_u_test(a, b):
+    """Two-sided p-value that durations in 'a' and 'b' come from the same distribution, with the normal approximation"""
+    n_a = len(a)
+    n_b = len(b)
+    values = sorted([(value, 0) for value in a] + [(value, 1) for value in b])
+
+    # Average ranks of tied values, and the tie correction of the variance
+    rank_sum_a = 0
+    ties_correction = 0
+    i = 0
+    while i < len(values):
+        j = i
+        while j < len(values) and values[j][0] == values[i][0]:
+            j += 1
+        rank = (i + j + 1) / 2
+        rank_sum_a += rank * sum(1 for (_, side) in values[i:j] if side == 0)
+        ties_correction += (j - i) ** 3 - (j - i)
+        i = j
+
+    u = rank_sum_a - n_a * (n_a + 1) / 2
+    n = n_a + n_b
+    variance = n_a * n_b / 12 * ((n + 1) - ties_correction / (n * (n - 1)))
+    if variance <= 0:
+        return 1.0
+    z = (abs(u - n_a * n_b / 2) - 0.5) / math.sqrt(variance)  # With continuity correction
+    return min(1.0, math.erfc(max(z, 0) / math.sqrt(2)))
+
+
+def write_comparisons(comparisons, f):
+    def change(value):
+        return f"{'':>9}" if value is None else f"{value * 100:+8.1f}%"
+
+    def p_value(value):
+        return f"{'':>8}" if value is None else f"{value:8.4f}"
+
+    f.write(f"{'Count A':>8} {'Count B':>8} {'Total':>9} {'Mean':>9} {'Median':>9} {'P99':>9} {'p-value':>8}  Stopwatch\n")
+    for comparison in comparisons:
+        f.write(
+            f"{comparison.executions_count_a:8} {comparison.executions_count_b:8}"
+            f" {change(comparison.total_change)} {change(comparison.mean_change)}"
+            f" {change(comparison.median_change)} {change(comparison.percentile_99_change)}"
+            f" {p_value(comparison.p_value)}  {comparison.name}"
+        )
+        if comparison.regressions:
+            f.write(f"  REGRESSION ({', '.join(comparison.regressions)})")
+        f.write("\n")
+
+
+def write_unmatched(a: RunStopwatches, b: RunStopwatches, f):
+    for (title, keys) in (("A", a.summaries.keys() - b.summaries.keys()), ("B", b.summaries.keys() - a.summaries.keys())):
+        for (function_name, label, light) in sorted(keys, key=sort_key):
+            name = function_name if label is None else f"{function_name} - {label}"
+            f.write(f"Only in {title}: {name}{' (light)' if light else ''}\n")
+
+
+def make_summary(function_name, count, total, median=None, percentile_99=None):
+    return Summary(
+        function_name=function_name, label=None, executions_count=count,
+        average_duration=None if count == 1 else total / count, duration_standard_deviation=None,
+        min_duration=None, median_duration=median, max_duration=None, total_duration=total,
+        percentile_99_duration=percentile_99,
+    )
+
+
+class MannWhitneyUTestTestCase(unittest.TestCase):
+    def test_same_distribution(self):
+        self.assertGreater(mann_whitney_u_test([1, 2, 3, 4, 5, 6], [1.5, 2.5, 3.5, 4.5, 5.5, 6.5]), 0.5)
+
+    def test_different_distributions(self):
+        self.assertLess(mann_whitney_u_test(list(range(20)), list(range(100, 120))), 0.001)
+
+    def test_all_equal(self):
+        self.assertEqual(mann_whitney_u_test([1, 1, 1], [1, 1, 1]), 1.0)
+
+    def test_reference_value(self):
+        # U = 4.5, variance = 30 / 12 * (12 - 18 / 110), z = (10.5 - 0.5) / sqrt(variance) = 1.838
+        self.assertAlmostEqual(mann_whitney_u_test([1, 2, 3, 4, 5], [3, 4, 5, 6, 7, 8]), 0.0660, places=4)
+
+
+class CompareRunsTestCase(unittest.TestCase):
+    def test_regression_on_heavy_stopwatches(self):
+        a = RunStopwatches({("f", None, False): make_summary("f", 20, 200, 10)}, {("f", None): [9, 11] * 10})
+        b = RunStopwatches({("f", None, False): make_summary("f", 20, 300, 15)}, {("f", None): [14, 16] * 10})
+        (comparison,) = compare_runs(a, b, Thresholds(mean=0.1))
+        self.assertAlmostEqual(comparison.total_change, 0.5)
+        self.assertAlmostEqual(comparison.mean_change, 0.5)
+        self.assertAlmostEqual(comparison.median_change, 0.5)
+        self.assertLess(comparison.p_value, 0.001)
+        self.assertEqual(comparison.regressions, ["mean"])
+
+    def test_not_significant(self):
+        a = RunStopwatches({("f", None, False): make_summary("f", 4, 40, 10)}, {("f", None): [5, 15, 8, 12]})
+        b = RunStopwatches({("f", None, False): make_summary("f", 4, 44, 11)}, {("f", None): [6, 16, 9, 13]})
+        (comparison,) = compare_runs(a, b, Thresholds(mean=0.05))
+        self.assertGreater(comparison.p_value, 0.05)
+        self.assertEqual(comparison.regressions, [])
+
+    def test_total_regression_without_significance(self):
+        a = RunStopwatches({("f", None, False): make_summary("f", 4, 40, 10)}, {("f", None): [5, 15, 8, 12]})
+        b = RunStopwatches({("f", None, False): make_summary("f", 4, 44, 11)}, {("f", None): [6, 16, 9, 13]})
+        (comparison,) = compare_runs(a, b, Thresholds(total=0.05, mean=0.05))
+        self.assertGreater(comparison.p_value, 0.05)
+        self.assertEqual(comparison.regressions, ["total"])
+
+    def test_light_and_heavy_stopwatches_with_same_name(self):
+        a = RunStopwatches(
+            {("f", None, False): make_summary("f", 2, 20, 10), ("f", None, True): make_summary("f", 10, 100)},
+            {("f", None): [10, 10]},
+        )
+        b = RunStopwatches(
+            {("f", None, False): make_summary("f", 2, 20, 10), ("f", None, True): make_summary("f", 10, 150)},
+            {("f", None): [10, 10]},
+        )
+        (heavy, light) = compare_runs(a, b, Thresholds(total=0.1))
+        self.assertEqual(heavy.name, "f")
+        self.assertAlmostEqual(heavy.total_change, 0)
+        self.assertEqual(heavy.regressions, [])
+        self.assertEqual(light.name, "f (light)")
+        self.assertAlmostEqual(light.total_change, 0.5)
+        self.assertIsNone(light.p_value)
+        self.assertEqual(light.regressions, ["total"])
+
+    def test_light_stopwatches_and_unmatched(self):
+        a = RunStopwatches({("f", None, True): make_summary("f", 10, 100), ("g", None, True): make_summary("g", 1, 10)}, {})
+        b = RunStopwatches({("f", None, True): make_summary("f", 10, 90), ("h", None, True): make_summary("h", 1, 10)}, {})
+        (comparison,) = compare_runs(a, b, Thresholds(total=0, mean=0))
+        self.assertEqual(comparison.name, "f (light)")
+        self.assertAlmostEqual(comparison.total_change, -0.1)
+        self.assertIsNone(comparison.p_value)
+        self.assertEqual(comparison.regressions, [])
+
+    def test_percentile_99_of_light_stopwatches(self):
+        a = RunStopwatches({("f", None, True): make_summary("f", 100, 1000, 10, 20)}, {})
+        b = RunStopwatches({("f", None, True): make_summary("f", 100, 1000, 10, 30)}, {})
+        (comparison,) = compare_runs(a, b, Thresholds(percentile_99=0.1))
+        self.assertAlmostEqual(comparison.percentile_99_change, 0.5)
+        self.assertEqual(comparison.regressions, ["percentile_99"])
+
+    def test_write(self):
+        f = io.StringIO()
+        write_comparisons(
+            [
+                Comparison("f", None, False, 20, 20, 0.5, 0.5, 0.5, None, 0.0001, ["mean"]),
+                Comparison("g", "label", True, 1, 1, -0.25, -0.25, None, None, None, []),
+            ],
+            f,
+        )
+        self.assertEqual(
+            f.getvalue(),
+            " Count A  Count B     Total      Mean    Median       P99  p-value  Stopwatch\n"
+            "      20       20    +50.0%    +50.0%    +50.0%             0.0001  f  REGRESSION (mean)\n"
+            "       1        1    -25.0%    -25.0%                               g - label (light)\n",
+        )
+
+    def test_write_unmatched(self):
+        f = io.StringIO()
+        write_unmatched(
+            RunStopwatches({("f", None, False): make_summary("f", 1, 10), ("g", "x", False): make_summary("g", 1, 10)}, {}),
+            RunStopwatches({("f", None, False): make_summary("f", 1, 10), ("h", None, True): make_summary("h", 1, 10)}, {}),
+            f,
+        )
+        self.assertEqual(f.getvalue(), "Only in A: g - x\nOnly in B: h (light)\n")
@@ -4,27 +4,45 @@
 from __future__ import annotations
 
 from typing import Dict, List, Optional, Tuple
+import bisect
 import dataclasses
+import itertools
+import unittest
 
 import matplotlib.pyplot as plt
 
 from ..monitoring import result as monitoring_result
 
 
-def make_graph(output_file):
-    results = monitoring_result.RunResults.load()
+FIGURE_WIDTH = 12  # Inches
+DPI = 120
 
+
+def make_graph(output_file, results, gantt_grapher, windowed_summaries, *, time_from=None, time_to=None):
+    """
+    Draw the graph of a run.
+
+    'gantt_grapher' is a 'GantGrapher' and 'windowed_summaries' the result of a 'WindowedSummariesExtractor',
+    both after processing all events of the run.
+    """
     origin_timestamp = results.main_process.started_between_timestamps[0]
 
-    gantt_grapher = GantGrapher(results)
+    # The time window to draw, in seconds since the start of the main process
+    if time_from is None:
+        time_from = 0
+    if time_to is None:
+        time_to = max(results.main_process.terminated_between_timestamps[1] - origin_timestamp, time_from)
 
-    n = 10 if results.run_settings.gpu_monitored else 7
+    n = (10 if results.run_settings.gpu_monitored else 7) + (1 if windowed_summaries else 0)
     fig, axes = plt.subplots(
         n, 1, squeeze=False,
         sharex=True,
-        figsize=(12, 4 * n + gantt_grapher.get_height() / 10), layout="constrained",
+        figsize=(FIGURE_WIDTH, 4 * n + gantt_grapher.get_height() / 10), layout="constrained",
         height_ratios=[gantt_grapher.get_height() / 15] + [1 for _ in range(n - 1)],
     )
+    if windowed_summaries:
+        ((windows_ax,),) = axes[1:2]
+        axes = [axes[0]] + list(axes[2:])
     if results.run_settings.gpu_monitored:
         (
             (chrones_ax,),
@@ -41,7 +59,21 @@ def make_graph(output_file):
             (inputs_ax,), (outputs_ax,), (open_files_ax,)
         ) = axes
 
-    gantt_grapher.draw(chrones_ax)
+    # Chrones shorter than a pixel are merged: drawing them one by one would be slow, and unreadable anyway
+    pixel_duration = (time_to - time_from) / (FIGURE_WIDTH * DPI)
+    gantt_grapher.draw(chrones_ax, time_from, time_to, pixel_duration)
+
+    if windowed_summaries:
+        for ((_, name), summaries) in windowed_summaries.items():
+            timestamps = [s.timestamp - origin_timestamp for s in summaries]
+            (line,) = windows_ax.plot(timestamps, [s.average_duration / 1e6 for s in summaries], ".-", label=f"{name[-30:]} (mean)")
+            if all(s.median_duration is not None for s in summaries):
+                windows_ax.plot(timestamps, [s.median_duration / 1e6 for s in summaries], "--", color=line.get_color(), label="(median)")
+            if all(s.percentile_99_duration is not None for s in summaries):
+                windows_ax.plot(timestamps, [s.percentile_99_duration / 1e6 for s in summaries], ":", color=line.get_color(), label="(p99)")
+        windows_ax.legend()
+        windows_ax.set_ylim(bottom=0)
+        windows_ax.set_ylabel("Light stopwatches\nby window (ms)")
 
     def plot_cpu(process: monitoring_result.Process):
         metrics = process.instant_metrics
@@ -161,10 +193,10 @@ def make_graph(output_file):
     open_files_ax.set_ylim(bottom=0)
     open_files_ax.set_ylabel("Open files")
 
-    axes[-1][0].set_xlim(left=0)
+    axes[-1][0].set_xlim(left=time_from, right=time_to)
     axes[-1][0].set_xlabel("Time (s)")
 
-    fig.savefig(output_file, dpi=120)
+    fig.savefig(output_file, dpi=DPI)
     plt.close(fig)
 
 
@@ -172,57 +204,111 @@ class GantGrapher:
     @dataclasses.dataclass
     class Thread:
         stack: List[monitoring_result.ChroneEvent]
-        chrones: Dict[str, Tuple[float, float]]
+        # Intervals of each chrone, relative to the origin. Converted to 'IntervalIndex' once all events are read.
+        chrones: Dict[str, List[Tuple[float, float]]]
         first_event: Optional[monitoring_result.ChroneEvent]
         last_event: Optional[monitoring_result.ChroneEvent]
+        os_thread_id: Optional[int] = None
+        # (timestamp, CPU percentage since previous timestamp, CPU the thread last ran on)
+        cpu_usage: List[Tuple[float, float, int]] = dataclasses.field(default_factory=list)
+
+        @property
+        def height(self):
+            return 2 + len(self.chrones) + (1 if self.cpu_usage else 0)
 
     def __init__(self, results: monitoring_result.RunResults):
         self.__results = results
         self.__origin_timestamp = results.main_process.started_between_timestamps[0]
-        self.__prepare()
-
-    def __prepare(self):
         self.__processes = []
         iter_processes(self.__results.main_process, before=lambda p: self.__processes.append(p))
-        self.__threads = {process.pid: self.__prepare_threads(process) for process in self.__processes}
-
-    def __prepare_threads(self, process: monitoring_result.Process):
-        threads = {}
-        for event in process.load_chrone_events():
-            thread = threads.setdefault(event.thread_id, GantGrapher.Thread([], {}, None, None))
-            if thread.first_event is None:
-                thread.first_event = event
-            thread.last_event = event
-
-            if event.__class__ == monitoring_result.StopwatchStart:
-                thread.stack.append(event)
-            elif event.__class__ == monitoring_result.StopwatchStop:
-                start_event = thread.stack.pop()
-                name = " - ".join(
-                    str(part)
-                    for part in filter(
-                        lambda p: p is not None,
-                        [start_event.function_name, start_event.label],
-                    )
+        # By process id and thread id, while events are processed
+        self.__threads_by_process_id: Dict[str, Dict[str, GantGrapher.Thread]] = {}
+        # By pid, once all events are processed
+        self.__threads = None
+
+    def process(self, event):
+        if event.__class__ == monitoring_result.ClockOffset:
+            return  # Already applied by 'load_chrone_events', and not related to a thread
+        if event.__class__ == monitoring_result.Telemetry:
+            return  # Reported by 'overhead.py'. Logged by the coordinator's worker thread, not by the program
+        if event.__class__ == monitoring_result.LockSummary:
+            return  # Reported by 'locks.py'
+        threads = self.__threads_by_process_id.setdefault(event.process_id, {})
+        thread = threads.setdefault(event.thread_id, GantGrapher.Thread([], {}, None, None))
+        if thread.first_event is None:
+            thread.first_event = event
+        thread.last_event = event
+
+        if event.__class__ == monitoring_result.StopwatchStart:
+            thread.stack.append(event)
+        elif event.__class__ == monitoring_result.StopwatchStop:
+            start_event = thread.stack.pop()
+            name = " - ".join(
+                str(part)
+                for part in filter(
+                    lambda p: p is not None,
+                    [start_event.function_name, start_event.label],
                 )
-                chrones = thread.chrones.setdefault(name, [])
-                chrones.append((start_event, event))
-            elif event.__class__ == monitoring_result.StopwatchSummary:
-                pass
-            else:
-                assert False
+            )
+            chrones = thread.chrones.setdefault(name, [])
+            chrones.append((start_event.timestamp - self.__origin_timestamp, event.timestamp - self.__origin_timestamp))
+        elif event.__class__ == monitoring_result.StopwatchExemplar:
+            # Slow executions of light stopwatches, drawn like heavy ones to show them in context
+            name = event.function_name if event.label is None else f"{event.function_name} - {event.label}"
+            chrones = thread.chrones.setdefault(name, [])
+            chrones.append((event.start_timestamp - self.__origin_timestamp, event.timestamp - self.__origin_timestamp))
+        elif event.__class__ == monitoring_result.StopwatchSummary:
+            pass
+        elif event.__class__ == monitoring_result.OsThread:
+            thread.os_thread_id = event.os_thread_id
+        else:
+            assert False
+
+    def __prepare(self):
+        if self.__threads is None:
+            self.__threads = {
+                process.pid: self.__prepare_threads(process, self.__threads_by_process_id.get(str(process.pid), {}))
+                for process in self.__processes
+            }
+
+    def __prepare_threads(self, process: monitoring_result.Process, threads: Dict[str, GantGrapher.Thread]):
         threads = list(threads.values())
         assert all(t.stack == [] for t in threads)
+        for thread in threads:
+            thread.chrones = {name: IntervalIndex(intervals) for (name, intervals) in thread.chrones.items()}
+
+        if self.__results.run_settings.threads_monitored:
+            self.__prepare_cpu_usage(process, threads)
 
         return threads
 
+    @staticmethod
+    def __prepare_cpu_usage(process: monitoring_result.Process, threads: List[GantGrapher.Thread]):
+        threads = {thread.os_thread_id: thread for thread in threads if thread.os_thread_id is not None}
+        previous_samples = {}
+        for metrics in process.instant_metrics:
+            for sample in metrics.threads_metrics or []:
+                thread = threads.get(sample.os_thread_id)
+                if thread is None:
+                    continue
+                cpu_time = sample.user_time + sample.system_time
+                previous = previous_samples.get(sample.os_thread_id)
+                if previous is not None and metrics.timestamp > previous[0]:
+                    cpu_percent = 100 * (cpu_time - previous[1]) / (metrics.timestamp - previous[0])
+                    thread.cpu_usage.append((previous[0], cpu_percent, sample.last_cpu))
+                previous_samples[sample.os_thread_id] = (metrics.timestamp, cpu_time)
+
     def get_height(self):
+        self.__prepare()
         return sum(
-            2 + sum(3 + len(thread.chrones) for thread in self.__threads[process.pid])
+            2 + sum(1 + thread.height for thread in self.__threads[process.pid])
             for process in self.__processes
         ) - 1
 
-    def draw(self, ax):
+    def draw(self, ax, time_from, time_to, pixel_duration):
+        self.__prepare()
+        self.__time_window = (time_from, time_to)
+        self.__pixel_duration = pixel_duration
         top_y = 0
 
         for process in self.__processes:
@@ -230,7 +316,7 @@ class GantGrapher:
             end_x = (process.terminated_between_timestamps[0] + process.terminated_between_timestamps[1]) / 2 - self.__origin_timestamp
             width = end_x - start_x
 
-            threads_height = sum(3 + len(thread.chrones) for thread in self.__threads[process.pid])
+            threads_height = sum(1 + thread.height for thread in self.__threads[process.pid])
             process_height = 1 + threads_height
 
             ax.broken_barh([(start_x, width)], (top_y - process_height, process_height), color="#ff8f8f")
@@ -251,26 +337,152 @@ class GantGrapher:
             end_x = thread.last_event.timestamp - self.__origin_timestamp
             width = end_x - start_x
 
-            thread_height = 2 + len(thread.chrones)
+            thread_height = thread.height
 
             ax.broken_barh([(start_x, width)], (top_y - thread_height, thread_height), color="#8fff8f")
             ax.text(x=start_x, y=top_y - 0.5, s=f"Thread {thread_index}", ha="left", va="center")
 
             self.__plot_chrones(start_x, top_y - 1, thread.chrones, ax)
+            if thread.cpu_usage:
+                self.__plot_cpu_usage(start_x, top_y - 1 - len(thread.chrones), thread.cpu_usage, ax)
 
             top_y -= 1 + thread_height
 
     def __plot_chrones(self, left_x, top_y, chrones, ax: plt.Axes):
-        for (name, events) in sorted(chrones.items(), key=lambda kv: kv[1][0][0].timestamp):
-            bars = [(start_event.timestamp - self.__origin_timestamp, stop_event.timestamp - start_event.timestamp) for (start_event, stop_event) in events]
-            ax.broken_barh(bars, (top_y - 1, 1), color="#8f8fff", edgecolor="black")
-            ax.text(x=left_x, y=top_y - 0.5, s=name, ha="left", va="center")
+        for (name, intervals) in sorted(chrones.items(), key=lambda kv: kv[1].starts[0]):
+            bars = merge_intervals(intervals.iter_overlapping(*self.__time_window), self.__pixel_duration)
+            # Individual chrones as before, merged ones without edges and as opaque as they are busy
+            single_bars = [(start, stop - start) for (start, stop, count, _) in bars if count == 1]
+            ax.broken_barh(single_bars, (top_y - 1, 1), color="#8f8fff", edgecolor="black")
+            merged_bars = [(start, stop - start) for (start, stop, count, _) in bars if count > 1]
+            coverages = [
+                (0.56, 0.56, 1, 0.2 + 0.8 * min(busy / (stop - start), 1) if stop > start else 1)
+                for (start, stop, count, busy) in bars if count > 1
+            ]
+            ax.broken_barh(merged_bars, (top_y - 1, 1), facecolors=coverages)
+            ax.text(x=max(left_x, self.__time_window[0]), y=top_y - 0.5, s=name, ha="left", va="center")
 
             top_y -= 1
 
+    def __plot_cpu_usage(self, left_x, top_y, cpu_usage, ax: plt.Axes):
+        # Real CPU usage of the thread, as measured by the OS, under its stopwatches: 100% fills the row.
+        # Red ticks show migrations of the thread from one CPU to another.
+        timestamps = [timestamp - self.__origin_timestamp for (timestamp, _, _) in cpu_usage]
+        ax.fill_between(
+            timestamps,
+            top_y - 1,
+            [top_y - 1 + min(cpu_percent, 100) / 100 for (_, cpu_percent, _) in cpu_usage],
+            step="post", color="#8f8f8f",
+        )
+        migrations = [
+            timestamp
+            for (timestamp, (_, _, previous_cpu), (_, _, cpu)) in zip(timestamps[1:], cpu_usage, cpu_usage[1:])
+            if cpu != previous_cpu
+        ]
+        ax.plot(migrations, [top_y - 0.5] * len(migrations), "|", color="red")
+        ax.text(x=left_x, y=top_y - 0.5, s="CPU (%)", ha="left", va="center")
+
+
+class IntervalIndex:
+    """The intervals of a chrone in a thread, to find those overlapping a time window without going through all of them"""
+
+    def __init__(self, intervals):
+        intervals = sorted(intervals)
+        self.starts = [start for (start, _) in intervals]
+        self.stops = [stop for (_, stop) in intervals]
+        # Nested intervals (recursive functions) make 'stops' unsorted, but this is sorted
+        self.__max_stops = list(itertools.accumulate(self.stops, max))
+
+    def __len__(self):
+        return len(self.starts)
+
+    def iter_overlapping(self, time_from, time_to):
+        """Yield '(start, stop)' of the intervals overlapping '[time_from, time_to]', by increasing start"""
+        begin = bisect.bisect_left(self.__max_stops, time_from)
+        end = bisect.bisect_right(self.starts, time_to)
+        for i in range(begin, end):
+            if self.stops[i] >= time_from:
+                yield (self.starts[i], self.stops[i])
+
+
+def merge_intervals(intervals, pixel_duration):
+    """
+    Merge intervals (sorted by start) shorter than 'pixel_duration' into coverage bars,
+    while they are separated by less than 'pixel_duration' and the bar is still shorter than 'pixel_duration'.
+    Wider intervals are kept as they are, so their boundaries are still drawn.
+
+    Return a list of '(start, stop, count, busy)' where 'count' is the number of merged intervals,
+    and 'busy' the sum of their durations. So there are at most about as many bars as pixels, plus the wide intervals.
+    """
+    bars = []
+    for (start, stop) in intervals:
+        if (
+            bars
+            and stop - start < pixel_duration
+            and bars[-1][1] - bars[-1][0] < pixel_duration
+            and start - bars[-1][1] < pixel_duration
+        ):
+            (bar_start, bar_stop, count, busy) = bars[-1]
+            bars[-1] = (bar_start, max(bar_stop, stop), count + 1, busy + stop - start)
+        else:
+            bars.append((start, stop, 1, stop - start))
+    return bars
+
+
+class WindowedSummariesExtractor:
+    # Programs run with CHRONES_SUMMARY_INTERVAL log the summaries of their light stopwatches periodically:
+    # each summary covers the time window since the previous one
+    def __init__(self):
+        # By process id and name
+        self.__summaries = {}
+
+    def process(self, event):
+        if event.__class__ == monitoring_result.StopwatchSummary and event.for_all_indexes:
+            name = event.function_name if event.label is None else f"{event.function_name} - {event.label}"
+            self.__summaries.setdefault((event.process_id, name), []).append(event)
+
+    @property
+    def result(self):
+        return {key: events for (key, events) in self.__summaries.items() if len(events) > 1}
+
 
 def iter_processes(process, *, before=lambda _: None, after=lambda _: None):
     before(process)
     for child in process.children:
         iter_processes(child, before=before, after=after)
     after(process)
+
+
+class IntervalIndexTestCase(unittest.TestCase):
+    def test_iter_overlapping(self):
+        index = IntervalIndex([(5, 6), (0, 1), (2, 3), (3, 10), (4, 5)])
+        self.assertEqual(list(index.iter_overlapping(0, 100)), [(0, 1), (2, 3), (3, 10), (4, 5), (5, 6)])
+        self.assertEqual(list(index.iter_overlapping(1.5, 1.8)), [])
+        self.assertEqual(list(index.iter_overlapping(1, 2)), [(0, 1), (2, 3)])
+        # Nested intervals: '(3, 10)' contains '(4, 5)' and '(5, 6)'
+        self.assertEqual(list(index.iter_overlapping(7, 8)), [(3, 10)])
+
+
+class MergeIntervalsTestCase(unittest.TestCase):
+    def test_long_intervals_are_kept(self):
+        self.assertEqual(merge_intervals([(0, 10), (20, 30)], 1), [(0, 10, 1, 10), (20, 30, 1, 10)])
+
+    def test_short_intervals_are_merged(self):
+        self.assertEqual(
+            merge_intervals([(0, 0.125), (0.5, 0.625), (0.75, 0.875), (5, 5.125)], 1),
+            [(0, 0.875, 3, 0.375), (5, 5.125, 1, 0.125)],
+        )
+
+    def test_adjacent_wide_intervals_are_kept(self):
+        self.assertEqual(merge_intervals([(0, 10), (10, 20)], 1), [(0, 10, 1, 10), (10, 20, 1, 10)])
+
+    def test_short_interval_after_wide_interval_is_kept(self):
+        self.assertEqual(merge_intervals([(0, 10), (10.25, 10.5)], 1), [(0, 10, 1, 10), (10.25, 10.5, 1, 0.25)])
+
+    def test_nested_intervals(self):
+        self.assertEqual(merge_intervals([(0, 10), (2, 3)], 1), [(0, 10, 1, 10), (2, 3, 1, 1)])
+
+    def test_bounded_by_resolution(self):
+        # 1000 s of intervals, at 1 s per pixel
+        intervals = [(i * 0.001, i * 0.001 + 0.0005) for i in range(1_000_000)]
+        self.assertLessEqual(len(merge_intervals(intervals, 1)), 1000)
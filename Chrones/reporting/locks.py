@@ -0,0 +1,131 @@
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+from __future__ import annotations
+
+import dataclasses
+import io
+import unittest
+
+from ..monitoring.result import LockSummary
+
+
+@dataclasses.dataclass
+class LockContention:
+    name: str
+    mode: str
+    acquisitions_count: int
+    contended_acquisitions_count: int
+    total_wait_duration: float
+    max_wait_duration: float
+    total_hold_duration: float
+    max_hold_duration: float
+    # Max of the 99th percentiles of all summaries: exact only if the lock was summarized once, in a single process
+    percentile_99_hold_duration: float
+
+    @property
+    def contended_ratio(self):
+        return self.contended_acquisitions_count / self.acquisitions_count
+
+    @property
+    def average_hold_duration(self):
+        return self.total_hold_duration / self.acquisitions_count
+
+
+class LockContentionsExtractor:
+    def __init__(self):
+        self.__summaries = []
+
+    def process(self, event):
+        if event.__class__ == LockSummary:
+            self.__summaries.append(event)
+
+    @property
+    def result(self):
+        return merge_lock_summaries(self.__summaries)
+
+
+def merge_lock_summaries(summaries):
+    """Merge summaries of the same lock (from periodic summaries or several processes), by name and mode"""
+    contentions = {}
+    for summary in summaries:
+        key = (summary.name, summary.mode)
+        contention = contentions.get(key)
+        if contention is None:
+            contentions[key] = LockContention(
+                name=summary.name,
+                mode=summary.mode,
+                acquisitions_count=summary.acquisitions_count,
+                contended_acquisitions_count=summary.contended_acquisitions_count,
+                total_wait_duration=summary.total_wait_duration,
+                max_wait_duration=summary.max_wait_duration,
+                total_hold_duration=summary.total_hold_duration,
+                max_hold_duration=summary.max_hold_duration,
+                percentile_99_hold_duration=summary.percentile_99_hold_duration,
+            )
+        else:
+            contention.acquisitions_count += summary.acquisitions_count
+            contention.contended_acquisitions_count += summary.contended_acquisitions_count
+            contention.total_wait_duration += summary.total_wait_duration
+            contention.max_wait_duration = max(contention.max_wait_duration, summary.max_wait_duration)
+            contention.total_hold_duration += summary.total_hold_duration
+            contention.max_hold_duration = max(contention.max_hold_duration, summary.max_hold_duration)
+            contention.percentile_99_hold_duration = max(contention.percentile_99_hold_duration, summary.percentile_99_hold_duration)
+    # Most waited for first
+    return sorted(contentions.values(), key=lambda contention: (-contention.total_wait_duration, contention.name, contention.mode))
+
+
+def write_lock_contentions(contentions, f):
+    # Totals in seconds, durations of single acquisitions in microseconds
+    f.write("Lock contention\n")
+    f.write(f"  {'Acquisitions':>12} {'Contended':>9} {'Total wait':>12} {'Max wait':>13} {'Total hold':>12} {'Mean hold':>13} {'P99 hold':>13}  Lock\n")
+    for contention in contentions:
+        f.write(
+            f"  {contention.acquisitions_count:12} {100 * contention.contended_ratio:8.1f}%"
+            f" {contention.total_wait_duration:10.6f} s {1e6 * contention.max_wait_duration:10.3f} us"
+            f" {contention.total_hold_duration:10.6f} s {1e6 * contention.average_hold_duration:10.3f} us"
+            f" {1e6 * contention.percentile_99_hold_duration:10.3f} us  {contention.name} ({contention.mode})\n"
+        )
+
+
+def make_lock_summary(name, mode, acquisitions_count, contended_acquisitions_count, total_wait_duration, total_hold_duration):
+    return LockSummary(
+        process_id="42", thread_id="1", timestamp=10,
+        name=name, mode=mode,
+        acquisitions_count=acquisitions_count, contended_acquisitions_count=contended_acquisitions_count,
+        total_wait_duration=total_wait_duration, max_wait_duration=total_wait_duration,
+        total_hold_duration=total_hold_duration, max_hold_duration=total_hold_duration / 2,
+        percentile_99_hold_duration=total_hold_duration / 4,
+    )
+
+
+class MergeLockSummariesTestCase(unittest.TestCase):
+    def test_merge(self):
+        contentions = merge_lock_summaries([
+            make_lock_summary("a", "exclusive", 10, 1, 0.001, 0.01),
+            make_lock_summary("b", "exclusive", 100, 50, 0.5, 0.1),
+            make_lock_summary("a", "exclusive", 30, 3, 0.002, 0.03),
+            make_lock_summary("a", "shared", 1000, 0, 0, 1),
+        ])
+        self.assertEqual([(c.name, c.mode) for c in contentions], [("b", "exclusive"), ("a", "exclusive"), ("a", "shared")])
+        a = contentions[1]
+        self.assertEqual(a.acquisitions_count, 40)
+        self.assertEqual(a.contended_acquisitions_count, 4)
+        self.assertAlmostEqual(a.contended_ratio, 0.1)
+        self.assertAlmostEqual(a.total_wait_duration, 0.003)
+        self.assertAlmostEqual(a.max_wait_duration, 0.002)
+        self.assertAlmostEqual(a.average_hold_duration, 0.001)
+        self.assertAlmostEqual(a.max_hold_duration, 0.015)
+        self.assertAlmostEqual(a.percentile_99_hold_duration, 0.0075)
+
+
+class WriteLockContentionsTestCase(unittest.TestCase):
+    def test_write(self):
+        f = io.StringIO()
+        write_lock_contentions(merge_lock_summaries([make_lock_summary("counter", "exclusive", 1000, 250, 0.5, 0.25)]), f)
+        self.assertEqual(
+            f.getvalue(),
+            "Lock contention\n"
+            "  Acquisitions Contended   Total wait      Max wait   Total hold     Mean hold      P99 hold  Lock\n"
+            "          1000     25.0%   0.500000 s 500000.000 us   0.250000 s    250.000 us  62500.000 us  counter (exclusive)\n",
+        )
@@ -0,0 +1,96 @@
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+from __future__ import annotations
+
+import dataclasses
+import io
+import unittest
+from typing import Optional
+
+from ..monitoring import result as monitoring_result
+from ..monitoring.result import Telemetry
+
+
+@dataclasses.dataclass
+class ProcessOverhead:
+    command: str
+    pid: int
+    telemetry: Telemetry
+    # User and system time of the process, only known for the main process
+    process_cpu_time: Optional[float]
+
+
+class InstrumentationOverheadExtractor:
+    def __init__(self, results: monitoring_result.RunResults):
+        self.__results = results
+        # By process id
+        self.__telemetries = {}
+
+    def process(self, event):
+        if event.__class__ == Telemetry:
+            self.__telemetries[event.process_id] = event  # Counts are cumulative: keep the last one
+
+    @property
+    def result(self):
+        return make_instrumentation_overhead(self.__results, self.__telemetries)
+
+
+def make_instrumentation_overhead(results, telemetries):
+    overheads = []
+
+    def walk(process):
+        telemetry = telemetries.get(str(process.pid))
+        if telemetry is not None:
+            if isinstance(process, monitoring_result.MainProcess):
+                process_cpu_time = process.global_metrics.user_time + process.global_metrics.system_time
+            else:
+                process_cpu_time = None
+            overheads.append(ProcessOverhead(process.command, process.pid, telemetry, process_cpu_time))
+        for child in process.children:
+            walk(child)
+
+    walk(results.main_process)
+    return overheads
+
+
+def write_instrumentation_overhead(overheads, f):
+    f.write("Instrumentation overhead\n")
+    for overhead in overheads:
+        telemetry = overhead.telemetry
+        f.write(f"  {overhead.command[-50:]} (pid {overhead.pid})\n")
+        f.write(f"    Events logged: {telemetry.events_count} ({telemetry.bytes_count} bytes)\n")
+        f.write(f"    Flushes: {telemetry.flushes_count} ({telemetry.flushes_duration:.6f} s)\n")
+        f.write(f"    Largest backlog: {telemetry.peak_backlog} events\n")
+        f.write(f"    Contentions: {telemetry.contentions_count} ({telemetry.contentions_duration:.6f} s)\n")
+        if telemetry.overwritten_events_count:
+            f.write(f"    Events overwritten by the flight recorder: {telemetry.overwritten_events_count}\n")
+        f.write(f"    Worker thread CPU time: {telemetry.worker_cpu_time:.6f} s")
+        if overhead.process_cpu_time:
+            f.write(f" ({100 * telemetry.worker_cpu_time / overhead.process_cpu_time:.1f}% of the process)")
+        f.write("\n")
+
+
+class WriteInstrumentationOverheadTestCase(unittest.TestCase):
+    def test_write(self):
+        telemetry = Telemetry(
+            process_id="42", thread_id="1", timestamp=10,
+            events_count=1000, bytes_count=30000,
+            flushes_count=5, flushes_duration=0.002,
+            peak_backlog=300,
+            contentions_count=2, contentions_duration=0.000004,
+            overwritten_events_count=0,
+            worker_cpu_time=0.01,
+        )
+        f = io.StringIO()
+        write_instrumentation_overhead([ProcessOverhead("program", 42, telemetry, 2.)], f)
+        self.assertEqual(
+            f.getvalue(),
+            "Instrumentation overhead\n"
+            "  program (pid 42)\n"
+            "    Events logged: 1000 (30000 bytes)\n"
+            "    Flushes: 5 (0.002000 s)\n"
+            "    Largest backlog: 300 events\n"
+            "    Contentions: 2 (0.000004 s)\n"
+            "    Worker thread CPU time: 0.010000 s (0.5% of the process)\n",
+        )
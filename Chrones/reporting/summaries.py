@@ -3,52 +3,52 @@
 
 from __future__ import annotations
 
-from typing import Optional
+from typing import Dict, Optional
 
 import collections
 import dataclasses
 import functools
-import itertools
+import io
 import math
 import statistics
 import unittest
 
-from ..monitoring import result as monitoring_result
-from ..monitoring.result import StopwatchStart, StopwatchStop, StopwatchSummary
+from ..monitoring.result import ClockOffset, LockSummary, OsThread, StopwatchExemplar, StopwatchStart, StopwatchStop, StopwatchSummary, Telemetry
 
 
-def make_summaries():
-    # @todo Accept results as a parameter.
-    # Right now I'm just doing as in graph.py, but I don't remember why I did it like that in that file.
-    results = monitoring_result.RunResults.load()
-
-    summaries = make_multi_process_summaries(get_all_events(results.main_process))
+def make_summaries(summaries):
     summaries = sorted(summaries, key=lambda summary: (summary.executions_count, -summary.total_duration))
     return [summary.json() for summary in summaries]
 
 
-def get_all_events(process):
-    yield from process.load_chrone_events()
-    for child in process.children:
-        yield from get_all_events(child)
+def make_throughput_summaries(summaries):
+    return sorted((summary for summary in summaries if summary.total_work is not None), key=lambda summary: summary.name)
 
 
 def make_multi_process_summaries(events):
-    if not events:
-        return []
-
-    (all_durations, all_summaries) = functools.reduce(
-        merge_durations_and_summaries,
-        (
-            extract_multi_threaded_durations(process_events)
-            for _, process_events in itertools.groupby(events, key=lambda e: e.process_id)
-        ),
-    )
+    extractor = MultiThreadedDurationsExtractor()
+    for event in events:
+        extractor.process(event)
+    return summarize(extractor)
+
+
+def summarize(extractor):
+    """Summaries of the stopwatches, from a 'MultiThreadedDurationsExtractor' that has processed all events"""
+    (all_durations, all_summaries) = extractor.result
+    all_works = extractor.works
+
+    # Summaries of light stopwatches for specific indexes, by index (or "+" for their other indexes)
+    indexed_summaries = {}
+    for ((function_name, label, index), summaries) in all_summaries.items():
+        if index is not None:
+            indexed_summaries.setdefault((function_name, label), {})[index] = summaries
 
     for (key, summaries) in all_summaries.items():
-        if len(summaries) == 1:
+        if key[2] is not None:
+            continue
+        elif len(summaries) == 1:
             summary = summaries[0]
-            yield Summary(
+            yield add_warm_up(indexed_summaries.get(key[:2]), Summary(
                 function_name=summary.function_name,
                 label=summary.label,
                 executions_count=summary.executions_count,
@@ -58,11 +58,19 @@ def make_multi_process_summaries(events):
                 median_duration=summary.median_duration,
                 max_duration=summary.max_duration,
                 total_duration=summary.total_duration,
-            )
+                self_duration=summary.self_duration,
+                percentile_99_duration=summary.percentile_99_duration,
+                work_executions_count=summary.work_executions_count,
+                total_work=summary.total_work,
+                average_throughput=summary.average_throughput,
+                min_throughput=summary.min_throughput,
+                median_throughput=summary.median_throughput,
+                percentile_1_throughput=summary.percentile_1_throughput,
+            ))
         else:
             assert len(summaries) > 1
             executions_count = sum(s.executions_count for s in summaries)
-            yield Summary(
+            yield add_warm_up(indexed_summaries.get(key[:2]), Summary(
                 function_name=summaries[0].function_name,
                 label=summaries[0].label,
                 executions_count=executions_count,
@@ -72,7 +80,9 @@ def make_multi_process_summaries(events):
                 median_duration=None,
                 max_duration=max(s.max_duration for s in summaries),
                 total_duration=sum(s.total_duration for s in summaries),
-            )
+                self_duration=None if any(s.self_duration is None for s in summaries) else sum(s.self_duration for s in summaries),
+                **merge_throughputs([s for s in summaries if s.total_work is not None]),
+            ))
 
     for (key, durations) in all_durations.items():
         if len(durations) > 1:
@@ -86,6 +96,7 @@ def make_multi_process_summaries(events):
                 median_duration=statistics.median(durations),
                 max_duration=max(durations),
                 total_duration=sum(durations),
+                **make_throughputs(all_works.get(key, [])),
             )
         else:
             assert len(durations) == 1
@@ -99,10 +110,66 @@ def make_multi_process_summaries(events):
                 median_duration=None,
                 max_duration=None,
                 total_duration=durations[0],
+                **make_throughputs(all_works.get(key, [])),
             )
 
 
-def make_stopwatch_start(process_id, thread_id, timestamp, function_name, label, index):
+def make_throughputs(works):
+    """Throughput fields of a 'Summary', from the durations and amounts of work of executions of heavy stopwatches"""
+    if not works:
+        return {}
+    throughputs = sorted(work / duration if duration > 0 else math.inf for (duration, work) in works)
+    total_work = sum(work for (_, work) in works)
+    total_duration = sum(duration for (duration, _) in works)
+    return dict(
+        work_executions_count=len(works),
+        total_work=total_work,
+        average_throughput=total_work / total_duration if total_duration > 0 else math.inf,
+        min_throughput=throughputs[0],
+        median_throughput=statistics.median(throughputs),
+        # Like the C++ instrumentation: a sample, no interpolation
+        percentile_1_throughput=throughputs[int(0.01 * len(throughputs))],
+    )
+
+
+def merge_throughputs(summaries):
+    """Throughput fields of a 'Summary', from several 'StopwatchSummary' events (with an amount of work)"""
+    if not summaries:
+        return {}
+    total_work = sum(s.total_work for s in summaries)
+    total_duration = sum(s.total_work / s.average_throughput for s in summaries if s.average_throughput > 0)
+    return dict(
+        work_executions_count=sum(s.work_executions_count for s in summaries),
+        total_work=total_work,
+        average_throughput=total_work / total_duration if total_duration > 0 else math.inf,
+        min_throughput=min(s.min_throughput for s in summaries),
+        median_throughput=None,
+        # Min of the 1st percentiles: exact only for a single summary
+        percentile_1_throughput=min(s.percentile_1_throughput for s in summaries),
+    )
+
+
+def add_warm_up(indexed_summaries, summary):
+    # Compare the first index (typically the first iteration of a loop, with cold caches) to the following ones
+    if indexed_summaries is None:
+        return summary
+    indexes = [index for index in indexed_summaries.keys() if index != "+"]
+    if not indexes:
+        return summary
+    warm_up_summaries = indexed_summaries[min(indexes)]
+    warm_up_executions_count = sum(s.executions_count for s in warm_up_summaries)
+    warm_up_total_duration = sum(s.total_duration for s in warm_up_summaries)
+    steady_state_executions_count = summary.executions_count - warm_up_executions_count
+    if steady_state_executions_count == 0:
+        return summary
+    return dataclasses.replace(
+        summary,
+        warm_up_average_duration=warm_up_total_duration / warm_up_executions_count,
+        steady_state_average_duration=(summary.total_duration - warm_up_total_duration) / steady_state_executions_count,
+    )
+
+
+def make_stopwatch_start(process_id, thread_id, timestamp, function_name, label=None, index=None):
     return StopwatchStart(
         process_id=process_id,
         thread_id=thread_id,
@@ -113,11 +180,12 @@ def make_stopwatch_start(process_id, thread_id, timestamp, function_name, label,
     )
 
 
-def make_stopwatch_stop(process_id, thread_id, timestamp):
+def make_stopwatch_stop(process_id, thread_id, timestamp, work=None):
     return StopwatchStop(
         process_id=process_id,
         thread_id=thread_id,
         timestamp=timestamp,
+        work=work,
     )
 
 
@@ -134,6 +202,9 @@ def make_stopwatch_summary(
     median_duration,
     max_duration,
     total_duration,
+    self_duration=None,
+    index=None,
+    other_indexes=False,
 ):
     return StopwatchSummary(
         process_id=process_id,
@@ -148,6 +219,9 @@ def make_stopwatch_summary(
         median_duration=median_duration,
         max_duration=max_duration,
         total_duration=total_duration,
+        self_duration=self_duration,
+        index=index,
+        other_indexes=other_indexes,
     )
 
 
@@ -198,6 +272,110 @@ class MakeMultiProcessSummariesTestCase(unittest.TestCase):
             ],
         )
 
+    def test_sw_summary_with_exemplar(self):
+        self.assertEqual(
+            self.make_multi_process_summaries([
+                StopwatchExemplar(process_id="p", thread_id="t", timestamp=30, function_name="f", label=None, index=None, duration=7e-9),
+                make_stopwatch_summary("p", "t", 42, "f", None, 12, 11, 10, 9, 8, 7, 6),
+            ]),
+            [
+                Summary("f", None, 12, 11, 10, 9, 8, 7, 6),
+            ],
+        )
+
+    def test_sw_summary_with_self_duration(self):
+        self.assertEqual(
+            self.make_multi_process_summaries([
+                make_stopwatch_summary("p", "t", 42, "f", None, 12, 11, 10, 9, 8, 7, 6, 5),
+            ]),
+            [
+                Summary("f", None, 12, 11, 10, 9, 8, 7, 6, 5),
+            ],
+        )
+
+    def test_multiple_sw_summaries_with_self_duration(self):
+        self.assertEqual(
+            self.make_multi_process_summaries([
+                make_stopwatch_summary("p", "t", 42, "f", None, 2, 11, 42, 10, 42, 11, 20, 15),
+                make_stopwatch_summary("p", "t", 42, "f", None, 4, 14, 42, 9, 42, 12, 40, 25),
+            ]),
+            [
+                Summary("f", None, 6, 13, None, 9, None, 12, 60, 40),
+            ],
+        )
+
+    def test_sw_summaries_with_indexes(self):
+        self.assertEqual(
+            self.make_multi_process_summaries([
+                make_stopwatch_summary("p", "t", 42, "f", "l", 6, 20, 42, 10, 42, 60, 120, 120),
+                make_stopwatch_summary("p", "t", 42, "f", "l", 1, 60, 42, 60, 42, 60, 60, 60, index=0),
+                make_stopwatch_summary("p", "t", 42, "f", "l", 2, 10, 42, 10, 42, 10, 20, 20, index=1),
+                make_stopwatch_summary("p", "t", 42, "f", "l", 3, 13, 42, 10, 42, 15, 40, 40, other_indexes=True),
+            ]),
+            [
+                Summary("f", "l", 6, 20, 42, 10, 42, 60, 120, 120, warm_up_average_duration=60, steady_state_average_duration=12),
+            ],
+        )
+
+    def test_sw_start_stop_pairs_with_work(self):
+        (summary,) = self.make_multi_process_summaries([
+            make_stopwatch_start("p", "t", 0, "f", None, None),
+            make_stopwatch_stop("p", "t", 2, work=100),
+            make_stopwatch_start("p", "t", 2, "f", None, None),
+            make_stopwatch_stop("p", "t", 3),
+            make_stopwatch_start("p", "t", 3, "f", None, None),
+            make_stopwatch_stop("p", "t", 4, work=300),
+            make_stopwatch_start("p", "t", 4, "f", None, None),
+            make_stopwatch_stop("p", "t", 8, work=100),
+        ])
+        self.assertEqual(summary.executions_count, 4)
+        self.assertEqual(summary.work_executions_count, 3)
+        self.assertEqual(summary.total_work, 500)
+        self.assertEqual(summary.average_throughput, 500 / 7)
+        self.assertEqual(summary.min_throughput, 25)
+        self.assertEqual(summary.median_throughput, 50)
+        self.assertEqual(summary.percentile_1_throughput, 25)
+
+    def test_sw_summaries_with_work(self):
+        work = dict(work_executions_count=2, total_work=300, average_throughput=100, min_throughput=50, median_throughput=60, percentile_1_throughput=50)
+        (summary,) = self.make_multi_process_summaries([
+            dataclasses.replace(make_stopwatch_summary("p", "t", 42, "f", None, 2, 11, 42, 10, 42, 11, 20), **work),
+        ])
+        self.assertEqual(summary.json()["average_throughput"], 100)
+        self.assertEqual(summary.json()["median_throughput"], 60)
+
+        (summary,) = self.make_multi_process_summaries([
+            dataclasses.replace(make_stopwatch_summary("p", "t", 42, "f", None, 2, 11, 42, 10, 42, 11, 20), **work),
+            dataclasses.replace(
+                make_stopwatch_summary("p", "t", 42, "f", None, 2, 11, 42, 10, 42, 11, 20),
+                work_executions_count=1, total_work=100, average_throughput=20, min_throughput=20, median_throughput=20, percentile_1_throughput=20,
+            ),
+            make_stopwatch_summary("p", "t", 42, "f", None, 2, 11, 42, 10, 42, 11, 20),
+        ])
+        self.assertEqual(summary.work_executions_count, 3)
+        self.assertEqual(summary.total_work, 400)
+        self.assertEqual(summary.average_throughput, 50)
+        self.assertEqual(summary.min_throughput, 20)
+        self.assertIsNone(summary.median_throughput)
+        self.assertEqual(summary.percentile_1_throughput, 20)
+
+    def test_write_throughputs(self):
+        f = io.StringIO()
+        write_throughputs(
+            [
+                Summary("f", "copy", 4, 1, 1, 1, 1, 1, 4, work_executions_count=3, total_work=3 * 2**30, average_throughput=12.5e9, min_throughput=999, median_throughput=12e9, percentile_1_throughput=999),
+                Summary("g", None, 4, 1, 1, 1, 1, 1, 4, work_executions_count=4, total_work=12, average_throughput=1.5, min_throughput=1, median_throughput=None, percentile_1_throughput=1),
+            ],
+            f,
+        )
+        self.assertEqual(
+            f.getvalue(),
+            "Throughput\n"
+            "  Executions Total work   Mean /s    Min /s Median /s     P1 /s  Stopwatch\n"
+            "           3     3.22 G   12.50 G  999.00     12.00 G  999.00    f - copy\n"
+            "           4    12.00      1.50      1.00                1.00    g\n",
+        )
+
     def test_multiple_sw_summaries(self):
         self.maxDiff = None
         # There *can* be several 'StopwatchSummary' events with the same function_name and label,
@@ -226,7 +404,25 @@ class Summary:
     median_duration: Optional[int]
     max_duration: Optional[int]
     total_duration: int
-    # @todo (not needed by Laurent for now) Add summaries per process and per thread
+    # Only known for light stopwatches
+    self_duration: Optional[int] = None
+    # Only known for light stopwatches summarized once (a single summary: not periodic, in a single process)
+    percentile_99_duration: Optional[int] = None
+    # Only known for light stopwatches with an index: average duration of their first index, and of the others
+    warm_up_average_duration: Optional[float] = None
+    steady_state_average_duration: Optional[float] = None
+    # Only known for stopwatches with an amount of work: throughputs, in work per second, of these executions
+    work_executions_count: Optional[int] = None
+    total_work: Optional[float] = None
+    average_throughput: Optional[float] = None
+    min_throughput: Optional[float] = None
+    median_throughput: Optional[float] = None
+    percentile_1_throughput: Optional[float] = None
+    # See 'ThreadImbalance' for summaries per thread
+
+    @property
+    def name(self):
+        return self.function_name if self.label is None else f"{self.function_name} - {self.label}"
 
     def json(self):
         d = collections.OrderedDict()
@@ -246,9 +442,43 @@ class Summary:
             if self.max_duration is not None:
                 d["max_duration"] = self.max_duration
         d["total_duration"] = self.total_duration
+        if self.self_duration is not None:
+            d["self_duration"] = self.self_duration
+        if self.warm_up_average_duration is not None:
+            d["warm_up_average_duration"] = self.warm_up_average_duration
+            d["steady_state_average_duration"] = self.steady_state_average_duration
+        if self.total_work is not None:
+            d["work_executions_count"] = self.work_executions_count
+            d["total_work"] = self.total_work
+            d["average_throughput"] = self.average_throughput
+            d["min_throughput"] = self.min_throughput
+            if self.median_throughput is not None:
+                d["median_throughput"] = self.median_throughput
+            d["percentile_1_throughput"] = self.percentile_1_throughput
         return d
 
 
+def write_throughputs(summaries, f):
+    def amount(value):
+        if value is None:
+            return f"{'':>9}"
+        for prefix in ("", "k", "M", "G", "T", "P"):
+            if abs(value) < 1000 or prefix == "P":
+                break
+            value /= 1000
+        return f"{value:7.2f} {prefix or ' '}"
+
+    # Work per second, in the unit given to 'CHRONES_SET_WORK' (e.g. bytes or items)
+    f.write("Throughput\n")
+    f.write(f"  {'Executions':>10} {'Total work':>10} {'Mean /s':>9} {'Min /s':>9} {'Median /s':>9} {'P1 /s':>9}  Stopwatch\n")
+    for summary in summaries:
+        f.write(
+            f"  {summary.work_executions_count:10}  {amount(summary.total_work)} {amount(summary.average_throughput)}"
+            f" {amount(summary.min_throughput)} {amount(summary.median_throughput)}"
+            f" {amount(summary.percentile_1_throughput)}  {summary.name}\n"
+        )
+
+
 def merge_durations_and_summaries(a, b):
     (durations_a, summaries_a) = a
     (durations_b, summaries_b) = b
@@ -274,13 +504,26 @@ def extract_multi_threaded_durations(events):
 
 
 class MultiThreadedDurationsExtractor:
+    # Events from different processes can be interleaved, e.g. by 'iter_timeline'
     def __init__(self):
         self.__extractors_per_thread = {}
 
     def process(self, event):
-        extractor = self.__extractors_per_thread.setdefault(event.thread_id, SingleThreadedDurationsExtractor())
+        extractor = self.__extractors_per_thread.setdefault((event.process_id, event.thread_id), SingleThreadedDurationsExtractor())
         extractor.process(event)
 
+    @property
+    def per_thread(self):
+        return self.__extractors_per_thread
+
+    @property
+    def works(self):
+        works = {}
+        for extractor in self.__extractors_per_thread.values():
+            for (key, thread_works) in extractor.works.items():
+                works.setdefault(key, []).extend(thread_works)
+        return works
+
     @property
     def result(self):
         if self.__extractors_per_thread:
@@ -296,7 +539,10 @@ class SingleThreadedDurationsExtractor:
     def __init__(self):
         self.__stack = []
         self.__durations = {}
+        self.__intervals = {}
+        self.__works = {}
         self.__summaries = {}
+        self.os_thread_id = None
 
     def process(self, event):
         if event.__class__ == StopwatchStart:
@@ -305,14 +551,34 @@ class SingleThreadedDurationsExtractor:
             start_event = self.__stack.pop()
             duration = event.timestamp - start_event.timestamp
             assert duration >= 0
-            durations = self.__durations.setdefault((start_event.function_name, start_event.label), [])
-            durations.append(duration)
+            key = (start_event.function_name, start_event.label)
+            self.__durations.setdefault(key, []).append(duration)
+            self.__intervals.setdefault(key, []).append((start_event.timestamp, event.timestamp))
+            if event.work is not None:
+                self.__works.setdefault(key, []).append((duration, event.work))
         elif event.__class__ == StopwatchSummary:
-            summaries = self.__summaries.setdefault((event.function_name, event.label), [])
+            index = None if event.for_all_indexes else ("+" if event.other_indexes else event.index)
+            summaries = self.__summaries.setdefault((event.function_name, event.label, index), [])
             summaries.append(event)
+        elif event.__class__ == OsThread:
+            self.os_thread_id = event.os_thread_id
+        elif event.__class__ in (ClockOffset, Telemetry, LockSummary, StopwatchExemplar):
+            pass
         else:
             assert False
 
+    @property
+    def intervals(self):
+        """Start and stop timestamps of heavy stopwatches"""
+        assert len(self.__stack) == 0
+        return self.__intervals
+
+    @property
+    def works(self):
+        """Durations and amounts of work of heavy stopwatches with an amount of work"""
+        assert len(self.__stack) == 0
+        return self.__works
+
     @property
     def result(self):
         assert len(self.__stack) == 0
@@ -401,3 +667,184 @@ class ExtractDurationsTestCase(unittest.TestCase):
             },
         )
 
+
+
+@dataclasses.dataclass
+class ThreadImbalance:
+    function_name: str
+    label: Optional[str]
+    # Total duration of the stopwatch in each thread, by thread name ('pid/tid')
+    thread_totals: Dict[str, float]
+    # Time between the first and the last threads to stop, for invocations started together by several threads
+    average_finish_spread: Optional[float] = None
+    max_finish_spread: Optional[float] = None
+
+    @property
+    def name(self):
+        return self.function_name if self.label is None else f"{self.function_name} - {self.label}"
+
+    @property
+    def mean_total(self):
+        return statistics.mean(self.thread_totals.values())
+
+    @property
+    def max_total(self):
+        return max(self.thread_totals.values())
+
+    @property
+    def imbalance_ratio(self):
+        """1 when all threads spent the same time, the number of threads when only one did"""
+        return self.max_total / self.mean_total if self.mean_total > 0 else 1
+
+    @property
+    def slowest_thread(self):
+        return max(self.thread_totals.items(), key=lambda item: item[1])[0]
+
+
+def extract_thread_imbalances(events):
+    extractor = MultiThreadedDurationsExtractor()
+    for event in events:
+        extractor.process(event)
+    return make_thread_imbalances(extractor)
+
+
+def make_thread_imbalances(extractor):
+    """Compare the threads that ran each heavy stopwatch, for stopwatches run by more than one thread.
+
+    Light stopwatches are not compared: the coordinator aggregates their executions from all threads
+    into the same summaries.
+    """
+    thread_totals = {}
+    intervals = {}
+    for ((process_id, thread_id), thread_extractor) in extractor.per_thread.items():
+        # With the process id: thread ids are only unique within a process (e.g. all shell scripts log thread 0)
+        thread_name = f"{process_id}/{thread_id if thread_extractor.os_thread_id is None else thread_extractor.os_thread_id}"
+        for (key, thread_intervals) in thread_extractor.intervals.items():
+            totals = thread_totals.setdefault(key, {})
+            totals[thread_name] = totals.get(thread_name, 0) + sum(stop - start for (start, stop) in thread_intervals)
+            intervals.setdefault(key, []).extend((thread_name, start, stop) for (start, stop) in thread_intervals)
+
+    imbalances = []
+    for (key, totals) in thread_totals.items():
+        if len(totals) < 2:
+            continue
+        spreads = make_finish_spreads(intervals.get(key, []))
+        imbalances.append(ThreadImbalance(
+            function_name=key[0],
+            label=key[1],
+            thread_totals=dict(sorted(totals.items(), key=lambda item: -item[1])),
+            average_finish_spread=statistics.mean(spreads) if spreads else None,
+            max_finish_spread=max(spreads) if spreads else None,
+        ))
+    # Most time lost waiting for the slowest thread first
+    return sorted(imbalances, key=lambda imbalance: (imbalance.mean_total - imbalance.max_total, imbalance.name))
+
+
+def make_finish_spreads(intervals):
+    """Group invocations started together, in different threads, before any of them stopped, like the threads of a parallel loop"""
+    spreads = []
+    group = []
+    for (thread_name, start, stop) in sorted(intervals, key=lambda interval: interval[1]):
+        if group and (start >= min(s for (_, _, s) in group) or thread_name in (t for (t, _, _) in group)):
+            if len(group) > 1:
+                spreads.append(max(s for (_, _, s) in group) - min(s for (_, _, s) in group))
+            group = []
+        group.append((thread_name, start, stop))
+    if len(group) > 1:
+        spreads.append(max(s for (_, _, s) in group) - min(s for (_, _, s) in group))
+    return spreads
+
+
+def write_thread_imbalances(imbalances, f):
+    f.write("Thread imbalance\n")
+    f.write(f"  {'Threads':>7} {'Mean total':>12} {'Max total':>12} {'Max/mean':>8} {'Mean spread':>12} {'Max spread':>12}  Stopwatch (slowest thread)\n")
+    for imbalance in imbalances:
+        if imbalance.max_finish_spread is None:
+            spreads = f"{'':>12} {'':>12}"
+        else:
+            spreads = f"{imbalance.average_finish_spread:10.6f} s {imbalance.max_finish_spread:10.6f} s"
+        f.write(
+            f"  {len(imbalance.thread_totals):7} {imbalance.mean_total:10.6f} s {imbalance.max_total:10.6f} s"
+            f" {imbalance.imbalance_ratio:8.2f} {spreads}  {imbalance.name} ({imbalance.slowest_thread})\n"
+        )
+        for (thread_name, total) in imbalance.thread_totals.items():
+            f.write(f"  {'':>7} {total:10.6f} s  {thread_name}\n")
+
+
+class ExtractThreadImbalancesTestCase(unittest.TestCase):
+    def test_single_thread(self):
+        self.assertEqual(
+            extract_thread_imbalances([
+                make_stopwatch_start("p", "t", 100, "f", None, None),
+                make_stopwatch_stop("p", "t", 200),
+            ]),
+            [],
+        )
+
+    def test_parallel_loop(self):
+        (imbalance,) = extract_thread_imbalances([
+            OsThread(process_id="p", thread_id="t_a", timestamp=0, os_thread_id=1001),
+            OsThread(process_id="p", thread_id="t_b", timestamp=0, os_thread_id=1002),
+            make_stopwatch_start("p", "t_a", 100, "f", "loop", None),
+            make_stopwatch_start("p", "t_b", 101, "f", "loop", None),
+            make_stopwatch_stop("p", "t_b", 150),
+            make_stopwatch_stop("p", "t_a", 200),
+            make_stopwatch_start("p", "t_a", 300, "f", "loop", None),
+            make_stopwatch_start("p", "t_b", 302, "f", "loop", None),
+            make_stopwatch_stop("p", "t_a", 320),
+            make_stopwatch_stop("p", "t_b", 400),
+        ])
+        self.assertEqual(imbalance.name, "f - loop")
+        self.assertEqual(imbalance.thread_totals, {"p/1001": 120, "p/1002": 147})
+        self.assertEqual(imbalance.slowest_thread, "p/1002")
+        self.assertAlmostEqual(imbalance.imbalance_ratio, 147 / 133.5)
+        self.assertEqual(imbalance.average_finish_spread, 65)
+        self.assertEqual(imbalance.max_finish_spread, 80)
+
+    def test_sequential_invocations_are_not_grouped(self):
+        self.assertEqual(
+            make_finish_spreads([("a", 0, 10), ("b", 10, 20), ("a", 20, 30), ("a", 30, 40), ("b", 31, 35)]),
+            [5],
+        )
+
+    def test_same_thread_id_in_different_processes(self):
+        (imbalance,) = extract_thread_imbalances([
+            make_stopwatch_start("p1", "0", 100, "f"),
+            make_stopwatch_start("p2", "0", 100, "f"),
+            make_stopwatch_stop("p2", "0", 130),
+            make_stopwatch_stop("p1", "0", 140),
+        ])
+        self.assertEqual(imbalance.thread_totals, {"p1/0": 40, "p2/0": 30})
+        self.assertEqual(imbalance.max_finish_spread, 10)
+
+    def test_light_stopwatches_are_ignored(self):
+        # Like logged by the coordinator: summaries of all threads, logged by the thread destroying it
+        (imbalance,) = extract_thread_imbalances([
+            make_stopwatch_start("p", "t_a", 100, "f", None, None),
+            make_stopwatch_start("p", "t_b", 100, "f", None, None),
+            make_stopwatch_stop("p", "t_b", 130),
+            make_stopwatch_stop("p", "t_a", 140),
+            make_stopwatch_summary("p", "t_a", 150, "f", None, 6, 11, 42, 10, 42, 11, 66_000_000_000),
+        ])
+        self.assertEqual(imbalance.thread_totals, {"p/t_a": 40, "p/t_b": 30})
+
+    def test_write(self):
+        f = io.StringIO()
+        write_thread_imbalances(
+            [
+                ThreadImbalance("f", "loop", {"42/1002": 0.3, "42/1001": 0.1}, 0.05, 0.08),
+                ThreadImbalance("g", None, {"42/1001": 0.2, "42/1002": 0.2}),
+            ],
+            f,
+        )
+        self.assertEqual(
+            f.getvalue(),
+            "Thread imbalance\n"
+            "  Threads   Mean total    Max total Max/mean  Mean spread   Max spread  Stopwatch (slowest thread)\n"
+            "        2   0.200000 s   0.300000 s     1.50   0.050000 s   0.080000 s  f - loop (42/1002)\n"
+            "            0.300000 s  42/1002\n"
+            "            0.100000 s  42/1001\n"
+            "        2   0.200000 s   0.200000 s     1.00                            g (42/1001)\n"
+            "            0.200000 s  42/1001\n"
+            "            0.200000 s  42/1002\n",
+        )
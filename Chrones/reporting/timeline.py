@@ -0,0 +1,127 @@
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+from __future__ import annotations
+
+import collections
+import heapq
+import unittest
+
+from .summaries import make_stopwatch_start, make_stopwatch_stop
+
+
+def iter_timeline(main_process):
+    """
+    Yield the events of all processes in a single stream, ordered by timestamp.
+
+    Timestamps include the clock offset of each process.
+    Logs are only sorted by thread (threads log concurrently), so we split each log by thread,
+    and merge all these streams with a heap, like in the merge phase of an external sort.
+    Logs are read lazily: see 'merge_threads'.
+    """
+    return merge_threads(iter_processes_events(main_process))
+
+
+def iter_processes_events(process):
+    yield (process.load_chrone_thread_starts(), process.load_chrone_events())
+    for child in process.children:
+        yield from iter_processes_events(child)
+
+
+def merge_threads(processes_events):
+    """
+    Merge the events of processes, given as '(thread_starts, events)' pairs, into a single stream ordered by timestamp.
+
+    'thread_starts' gives the timestamp of the first event of each thread of the process.
+    It lets the heap hold threads that have not been read yet, so each process' events are read only when they are due,
+    and only events logged out of order are buffered (see 'ThreadsSplitter').
+    """
+    heap = []
+    for (thread_starts, events) in processes_events:
+        splitter = ThreadsSplitter(events)
+        for (thread_id, timestamp) in thread_starts.items():
+            # 'len(heap)' breaks ties, so events are never compared
+            heap.append((timestamp, len(heap), None, splitter.iter_thread(thread_id)))
+    heapq.heapify(heap)
+
+    while heap:
+        (_, order, event, thread_events) = heap[0]
+        if event is not None:
+            yield event
+        next_event = next(thread_events, None)
+        if next_event is None:
+            heapq.heappop(heap)
+        else:
+            heapq.heapreplace(heap, (next_event.timestamp, order, next_event, thread_events))
+
+
+class ThreadsSplitter:
+    """Split the events of a process by thread, reading them only as far as needed"""
+
+    def __init__(self, events):
+        self.__events = iter(events)
+        # Events already read, by thread, waiting to be yielded by 'iter_thread'
+        self.__pending = collections.defaultdict(collections.deque)
+
+    def iter_thread(self, thread_id):
+        pending = self.__pending[thread_id]
+        while True:
+            if pending:
+                yield pending.popleft()
+            else:
+                event = next(self.__events, None)
+                if event is None:
+                    return
+                self.__pending[event.thread_id].append(event)
+
+
+class MergeThreadsTestCase(unittest.TestCase):
+    def test_empty(self):
+        self.assertEqual(list(merge_threads([])), [])
+
+    def test_processes_and_threads(self):
+        self.assertEqual(
+            list(merge_threads([
+                (
+                    {"t1": 1, "t2": 3},
+                    [
+                        make_stopwatch_start("p1", "t1", 1, "f"),
+                        make_stopwatch_start("p1", "t2", 3, "f"),
+                        make_stopwatch_stop("p1", "t2", 4),
+                        # Logged after 't2' events, but earlier
+                        make_stopwatch_stop("p1", "t1", 2),
+                    ],
+                ),
+                (
+                    {"t1": 0},
+                    [
+                        make_stopwatch_start("p2", "t1", 0, "f"),
+                        make_stopwatch_stop("p2", "t1", 5),
+                    ],
+                ),
+            ])),
+            [
+                make_stopwatch_start("p2", "t1", 0, "f"),
+                make_stopwatch_start("p1", "t1", 1, "f"),
+                make_stopwatch_stop("p1", "t1", 2),
+                make_stopwatch_start("p1", "t2", 3, "f"),
+                make_stopwatch_stop("p1", "t2", 4),
+                make_stopwatch_stop("p2", "t1", 5),
+            ],
+        )
+
+    def test_events_are_read_lazily(self):
+        read = []
+
+        def iter_events():
+            for timestamp in range(1000):
+                read.append(timestamp)
+                yield make_stopwatch_start("p", "t1", timestamp, "f")
+            # A thread that starts late in the log doesn't make the merge read the whole log up front
+            read.append(1000)
+            yield make_stopwatch_start("p", "t2", 1000, "f")
+
+        merged = merge_threads([({"t1": 0, "t2": 1000}, iter_events())])
+        self.assertEqual(next(merged).timestamp, 0)
+        self.assertEqual(read, [0])
+        self.assertEqual([event.timestamp for event in merged], list(range(1, 1001)))
@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+set -o errexit
+
+
+source <(chrones instrument shell enable program)
+
+
+chrones_start main
+for i in $(seq 3)
+do
+  chrones_start compute
+  chrones_start sleep
+  sleep 0.1
+  chrones_stop
+  chrones_stop
+done
+chrones_start sleep
+sleep 0.1
+chrones_stop
+chrones_stop
@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+set -o errexit
+trap 'echo "Error on ${BASH_SOURCE[0]}:$LINENO"' ERR
+
+
+chrones run -- ./program.sh
+chrones report --call-paths call-paths.txt --folded-stacks stacks.folded
+test $(grep -c . call-paths.txt) -eq 5
+grep -E ' 3      sleep$' call-paths.txt
+grep -E ' 1    sleep$' call-paths.txt
+test $(grep -c '^main;compute;sleep [0-9]*$' stacks.folded) -eq 1
+test $(grep -c '^main;sleep [0-9]*$' stacks.folded) -eq 1
+rm run-result.json *.chrones.csv report.png call-paths.txt stacks.folded
@@ -24,3 +24,5 @@ chrones instrument shell enable --help >'chrones instrument shell enable --help'
 chrones run --help >'chrones run --help'
 
 chrones report --help >'chrones report --help'
+
+chrones compare --help >'chrones compare --help'
@@ -0,0 +1,25 @@
+// Copyright 2020-2022 Laurent Cabaret
+// Copyright 2020-2022 Vincent Jacques
+
+#include <chrones.hpp>
+
+#include <chrono>  // NOLINT(build/c++11)
+#include <thread>  // NOLINT(build/c++11)
+
+
+CHRONABLE("program")
+
+void sleep_a_bit() {
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+void compute() {
+  for (int i = 0; i != 3; ++i) {
+    sleep_a_bit();
+  }
+}
+
+int main() {
+  compute();
+  sleep_a_bit();
+}
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Copyright 2020-2022 Laurent Cabaret
+# Copyright 2020-2022 Vincent Jacques
+
+set -o errexit
+trap 'echo "Error on ${BASH_SOURCE[0]}:$LINENO"' ERR
+
+
+rm -f *.chrones.csv *.chrones.maps
+make program
+
+
+chrones run -- ./program
+test -f program.*.chrones.maps
+chrones report --call-paths call-paths.txt
+test $(grep -c . call-paths.txt) -eq 5
+grep -E ' 1  main$' call-paths.txt
+grep -E ' 3      sleep_a_bit\(\)$' call-paths.txt
+grep -E ' 1    sleep_a_bit\(\)$' call-paths.txt
+
+
+CHRONES_FUNCTIONS_STOPWATCHES=light CHRONES_FUNCTIONS_EXCLUDED=_Z7computev chrones run -- ./program
+chrones report --call-paths call-paths.txt
+test $(grep -c . call-paths.txt) -eq 3
+grep -E ' 4  sleep_a_bit\(\)$' call-paths.txt
+
+
+rm run-result.json *.chrones.csv *.chrones.maps report.png call-paths.txt program program.o chrones-functions.o